@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "driver/mcpwm_types.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +18,15 @@ extern "C" {
  */
 typedef struct bdc_motor_t *bdc_motor_handle_t;
 
+/**
+ * @brief BDC Motor current decay mode, i.e. what the H-bridge does in the off part of each PWM period
+ */
+typedef enum {
+    BDC_MOTOR_DECAY_FAST = 0, /*!< Drive / coast, the current decays through the body diodes */
+    BDC_MOTOR_DECAY_SLOW,     /*!< Drive / brake, the current recirculates through the low side, speed is close to linear in duty */
+    BDC_MOTOR_DECAY_MIXED,    /*!< Drive / brake / coast, the off part is split evenly between slow and fast decay */
+} bdc_motor_decay_t;
+
 /**
  * @brief Enable BDC motor
  *
@@ -98,6 +108,21 @@ esp_err_t bdc_motor_coast(bdc_motor_handle_t motor);
  */
 esp_err_t bdc_motor_brake(bdc_motor_handle_t motor);
 
+/**
+ * @brief Set the current decay mode
+ *
+ * @note The new mode takes effect immediately if the motor is running forward or reverse, otherwise on the next direction change
+ *
+ * @param motor: BDC Motor handle
+ * @param decay: Decay mode
+ *
+ * @return
+ *      - ESP_OK: Set decay mode successfully
+ *      - ESP_ERR_INVALID_ARG: Set decay mode failed because of invalid parameters
+ *      - ESP_FAIL: Set decay mode failed because some other error occurred
+ */
+esp_err_t bdc_motor_set_decay(bdc_motor_handle_t motor, bdc_motor_decay_t decay);
+
 /**
  * @brief Free BDC Motor resources
  *
@@ -122,8 +147,10 @@ typedef struct {
  * @brief BDC Motor MCPWM specific configuration
  */
 typedef struct {
-    int group_id;           /*!< MCPWM group number */
-    uint32_t resolution_hz; /*!< MCPWM timer resolution */
+    int group_id;                   /*!< MCPWM group number */
+    uint32_t resolution_hz;         /*!< MCPWM timer resolution */
+    mcpwm_sync_handle_t sync_src;   /*!< Sync source that resets the timer to zero, must belong to the same group, NULL for a free-running timer */
+    bdc_motor_decay_t decay;        /*!< Initial current decay mode */
 } bdc_motor_mcpwm_config_t;
 
 /**
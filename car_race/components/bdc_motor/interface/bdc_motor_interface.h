@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "bdc_motor.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -99,6 +100,19 @@ struct bdc_motor_t {
      */
     esp_err_t (*brake)(bdc_motor_t *motor);
 
+    /**
+     * @brief Set the current decay mode
+     *
+     * @param motor: BDC Motor handle
+     * @param decay: Decay mode
+     *
+     * @return
+     *      - ESP_OK: Set decay mode successfully
+     *      - ESP_ERR_INVALID_ARG: Set decay mode failed because of invalid parameters
+     *      - ESP_FAIL: Set decay mode failed because some other error occurred
+     */
+    esp_err_t (*set_decay)(bdc_motor_t *motor, bdc_motor_decay_t decay);
+
     /**
      * @brief Free BDC Motor handle resources
      *
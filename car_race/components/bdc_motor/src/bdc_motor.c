@@ -55,6 +55,12 @@ esp_err_t bdc_motor_brake(bdc_motor_handle_t motor)
     return motor->brake(motor);
 }
 
+esp_err_t bdc_motor_set_decay(bdc_motor_handle_t motor, bdc_motor_decay_t decay)
+{
+    ESP_RETURN_ON_FALSE(motor && motor->set_decay, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    return motor->set_decay(motor, decay);
+}
+
 esp_err_t bdc_motor_del(bdc_motor_handle_t motor)
 {
     ESP_RETURN_ON_FALSE(motor, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
@@ -14,6 +14,12 @@
 
 static const char *TAG = "bdc_motor_mcpwm";
 
+typedef enum {
+    BDC_MOTOR_MCPWM_DIR_NONE = 0,
+    BDC_MOTOR_MCPWM_DIR_FORWARD,
+    BDC_MOTOR_MCPWM_DIR_REVERSE,
+} bdc_motor_mcpwm_dir_t;
+
 typedef struct {
     bdc_motor_t base;
     mcpwm_timer_handle_t timer;
@@ -22,13 +28,103 @@ typedef struct {
     mcpwm_cmpr_handle_t cmpb;
     mcpwm_gen_handle_t gena;
     mcpwm_gen_handle_t genb;
+    uint32_t period_ticks;
+    uint32_t speed;
+    bdc_motor_decay_t decay;
+    bdc_motor_mcpwm_dir_t dir;          // direction currently driven, NONE when coasting or braking
+    bdc_motor_mcpwm_dir_t action_dir;   // direction the generator actions are set up for
+    bdc_motor_decay_t action_decay;     // decay mode the generator actions are set up for
 } bdc_motor_mcpwm_obj;
 
+/*
+ * Within one PWM period, comparator A ends the drive part and comparator B ends the slow decay part of mixed decay.
+ * The generator on the high side of the current direction is the drive leg, the other one is the return leg:
+ *   fast decay:  drive leg high until A, return leg forced low           -> drive / coast
+ *   slow decay:  drive leg forced high, return leg high from A           -> drive / brake
+ *   mixed decay: drive leg high until B, return leg high from A until B  -> drive / brake / coast
+ * so the drive time is always `speed` ticks, whatever the mode.
+ */
+static esp_err_t bdc_motor_mcpwm_set_actions(bdc_motor_mcpwm_obj *mcpwm_motor, mcpwm_gen_handle_t gen, mcpwm_generator_action_t on_empty,
+                                             mcpwm_generator_action_t on_cmpa, mcpwm_generator_action_t on_cmpb)
+{
+    ESP_RETURN_ON_ERROR(mcpwm_generator_set_actions_on_timer_event(gen,
+                        MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_EMPTY, on_empty),
+                        MCPWM_GEN_TIMER_EVENT_ACTION_END()), TAG, "set timer event action failed");
+    ESP_RETURN_ON_ERROR(mcpwm_generator_set_actions_on_compare_event(gen,
+                        MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, mcpwm_motor->cmpa, on_cmpa),
+                        MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, mcpwm_motor->cmpb, on_cmpb),
+                        MCPWM_GEN_COMPARE_EVENT_ACTION_END()), TAG, "set compare event action failed");
+    return ESP_OK;
+}
+
+static esp_err_t bdc_motor_mcpwm_update_cmpb(bdc_motor_mcpwm_obj *mcpwm_motor)
+{
+    // comparator B is only used by mixed decay, half of the off part is slow decay
+    if (mcpwm_motor->decay != BDC_MOTOR_DECAY_MIXED) {
+        return ESP_OK;
+    }
+    uint32_t speed = mcpwm_motor->speed < mcpwm_motor->period_ticks ? mcpwm_motor->speed : mcpwm_motor->period_ticks;
+    uint32_t cmpb = speed + (mcpwm_motor->period_ticks - speed) / 2;
+    ESP_RETURN_ON_ERROR(mcpwm_comparator_set_compare_value(mcpwm_motor->cmpb, cmpb), TAG, "set compare value failed");
+    return ESP_OK;
+}
+
+static esp_err_t bdc_motor_mcpwm_drive(bdc_motor_mcpwm_obj *mcpwm_motor)
+{
+    bool forward = mcpwm_motor->dir == BDC_MOTOR_MCPWM_DIR_FORWARD;
+    mcpwm_gen_handle_t gen_drive = forward ? mcpwm_motor->gena : mcpwm_motor->genb;
+    mcpwm_gen_handle_t gen_return = forward ? mcpwm_motor->genb : mcpwm_motor->gena;
+    bool update_actions = mcpwm_motor->action_dir != mcpwm_motor->dir || mcpwm_motor->action_decay != mcpwm_motor->decay;
+
+    switch (mcpwm_motor->decay) {
+    case BDC_MOTOR_DECAY_SLOW:
+        if (update_actions) {
+            ESP_RETURN_ON_ERROR(bdc_motor_mcpwm_set_actions(mcpwm_motor, gen_return, MCPWM_GEN_ACTION_LOW, MCPWM_GEN_ACTION_HIGH, MCPWM_GEN_ACTION_KEEP), TAG, "set return leg actions failed");
+        }
+        ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(gen_drive, 1, true), TAG, "set force level for drive leg failed");
+        ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(gen_return, -1, true), TAG, "disable force level for return leg failed");
+        break;
+    case BDC_MOTOR_DECAY_MIXED:
+        if (update_actions) {
+            ESP_RETURN_ON_ERROR(bdc_motor_mcpwm_set_actions(mcpwm_motor, gen_drive, MCPWM_GEN_ACTION_HIGH, MCPWM_GEN_ACTION_KEEP, MCPWM_GEN_ACTION_LOW), TAG, "set drive leg actions failed");
+            ESP_RETURN_ON_ERROR(bdc_motor_mcpwm_set_actions(mcpwm_motor, gen_return, MCPWM_GEN_ACTION_LOW, MCPWM_GEN_ACTION_HIGH, MCPWM_GEN_ACTION_LOW), TAG, "set return leg actions failed");
+        }
+        ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(gen_drive, -1, true), TAG, "disable force level for drive leg failed");
+        ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(gen_return, -1, true), TAG, "disable force level for return leg failed");
+        break;
+    default:
+        if (update_actions) {
+            ESP_RETURN_ON_ERROR(bdc_motor_mcpwm_set_actions(mcpwm_motor, gen_drive, MCPWM_GEN_ACTION_HIGH, MCPWM_GEN_ACTION_LOW, MCPWM_GEN_ACTION_KEEP), TAG, "set drive leg actions failed");
+        }
+        ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(gen_drive, -1, true), TAG, "disable force level for drive leg failed");
+        ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(gen_return, 0, true), TAG, "set force level for return leg failed");
+        break;
+    }
+    mcpwm_motor->action_dir = mcpwm_motor->dir;
+    mcpwm_motor->action_decay = mcpwm_motor->decay;
+    return ESP_OK;
+}
+
 static esp_err_t bdc_motor_mcpwm_set_speed(bdc_motor_t *motor, uint32_t speed)
 {
     bdc_motor_mcpwm_obj *mcpwm_motor = __containerof(motor, bdc_motor_mcpwm_obj, base);
     ESP_RETURN_ON_ERROR(mcpwm_comparator_set_compare_value(mcpwm_motor->cmpa, speed), TAG, "set compare value failed");
-    ESP_RETURN_ON_ERROR(mcpwm_comparator_set_compare_value(mcpwm_motor->cmpb, speed), TAG, "set compare value failed");
+    mcpwm_motor->speed = speed;
+    return bdc_motor_mcpwm_update_cmpb(mcpwm_motor);
+}
+
+static esp_err_t bdc_motor_mcpwm_set_decay(bdc_motor_t *motor, bdc_motor_decay_t decay)
+{
+    bdc_motor_mcpwm_obj *mcpwm_motor = __containerof(motor, bdc_motor_mcpwm_obj, base);
+    ESP_RETURN_ON_FALSE(decay >= BDC_MOTOR_DECAY_FAST && decay <= BDC_MOTOR_DECAY_MIXED, ESP_ERR_INVALID_ARG, TAG, "invalid decay mode");
+    if (mcpwm_motor->decay == decay) {
+        return ESP_OK;
+    }
+    mcpwm_motor->decay = decay;
+    ESP_RETURN_ON_ERROR(bdc_motor_mcpwm_update_cmpb(mcpwm_motor), TAG, "update compare B failed");
+    if (mcpwm_motor->dir != BDC_MOTOR_MCPWM_DIR_NONE) {
+        return bdc_motor_mcpwm_drive(mcpwm_motor);
+    }
     return ESP_OK;
 }
 
@@ -51,22 +147,21 @@ static esp_err_t bdc_motor_mcpwm_disable(bdc_motor_t *motor)
 static esp_err_t bdc_motor_mcpwm_forward(bdc_motor_t *motor)
 {
     bdc_motor_mcpwm_obj *mcpwm_motor = __containerof(motor, bdc_motor_mcpwm_obj, base);
-    ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->gena, -1, true), TAG, "disable force level for gena failed");
-    ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->genb, 0, true), TAG, "set force level for genb failed");
-    return ESP_OK;
+    mcpwm_motor->dir = BDC_MOTOR_MCPWM_DIR_FORWARD;
+    return bdc_motor_mcpwm_drive(mcpwm_motor);
 }
 
 static esp_err_t bdc_motor_mcpwm_reverse(bdc_motor_t *motor)
 {
     bdc_motor_mcpwm_obj *mcpwm_motor = __containerof(motor, bdc_motor_mcpwm_obj, base);
-    ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->genb, -1, true), TAG, "disable force level for genb failed");
-    ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->gena, 0, true), TAG, "set force level for gena failed");
-    return ESP_OK;
+    mcpwm_motor->dir = BDC_MOTOR_MCPWM_DIR_REVERSE;
+    return bdc_motor_mcpwm_drive(mcpwm_motor);
 }
 
 static esp_err_t bdc_motor_mcpwm_coast(bdc_motor_t *motor)
 {
     bdc_motor_mcpwm_obj *mcpwm_motor = __containerof(motor, bdc_motor_mcpwm_obj, base);
+    mcpwm_motor->dir = BDC_MOTOR_MCPWM_DIR_NONE;
     ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->gena, 0, true), TAG, "set force level for gena failed");
     ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->genb, 0, true), TAG, "set force level for genb failed");
     return ESP_OK;
@@ -75,6 +170,7 @@ static esp_err_t bdc_motor_mcpwm_coast(bdc_motor_t *motor)
 static esp_err_t bdc_motor_mcpwm_brake(bdc_motor_t *motor)
 {
     bdc_motor_mcpwm_obj *mcpwm_motor = __containerof(motor, bdc_motor_mcpwm_obj, base);
+    mcpwm_motor->dir = BDC_MOTOR_MCPWM_DIR_NONE;
     ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->gena, 1, true), TAG, "set force level for gena failed");
     ESP_RETURN_ON_ERROR(mcpwm_generator_set_force_level(mcpwm_motor->genb, 1, true), TAG, "set force level for genb failed");
     return ESP_OK;
@@ -98,6 +194,7 @@ esp_err_t bdc_motor_new_mcpwm_device(const bdc_motor_config_t *motor_config, con
     bdc_motor_mcpwm_obj *mcpwm_motor = NULL;
     esp_err_t ret = ESP_OK;
     ESP_GOTO_ON_FALSE(motor_config && mcpwm_config && ret_motor, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+    ESP_GOTO_ON_FALSE(mcpwm_config->decay >= BDC_MOTOR_DECAY_FAST && mcpwm_config->decay <= BDC_MOTOR_DECAY_MIXED, ESP_ERR_INVALID_ARG, err, TAG, "invalid decay mode");
     mcpwm_motor = calloc(1, sizeof(bdc_motor_mcpwm_obj));
     ESP_GOTO_ON_FALSE(mcpwm_motor, ESP_ERR_NO_MEM, err, TAG, "no mem for rmt motor");
 
@@ -110,6 +207,18 @@ esp_err_t bdc_motor_new_mcpwm_device(const bdc_motor_config_t *motor_config, con
         .count_mode = MCPWM_TIMER_COUNT_MODE_UP,
     };
     ESP_GOTO_ON_ERROR(mcpwm_new_timer(&timer_config, &mcpwm_motor->timer), err, TAG, "create MCPWM timer failed");
+    mcpwm_motor->period_ticks = timer_config.period_ticks;
+    mcpwm_motor->decay = mcpwm_config->decay;
+
+    if (mcpwm_config->sync_src) {
+        // restart counting from zero on every sync event, so timers sharing the source run in phase
+        mcpwm_timer_sync_phase_config_t sync_phase_config = {
+            .sync_src = mcpwm_config->sync_src,
+            .count_value = 0,
+            .direction = MCPWM_TIMER_DIRECTION_UP,
+        };
+        ESP_GOTO_ON_ERROR(mcpwm_timer_set_phase_on_sync(mcpwm_motor->timer, &sync_phase_config), err, TAG, "set sync phase failed");
+    }
 
     mcpwm_operator_config_t operator_config = {
         .group_id = mcpwm_config->group_id,
@@ -155,6 +264,7 @@ esp_err_t bdc_motor_new_mcpwm_device(const bdc_motor_config_t *motor_config, con
     mcpwm_motor->base.coast = bdc_motor_mcpwm_coast;
     mcpwm_motor->base.brake = bdc_motor_mcpwm_brake;
     mcpwm_motor->base.set_speed = bdc_motor_mcpwm_set_speed;
+    mcpwm_motor->base.set_decay = bdc_motor_mcpwm_set_decay;
     mcpwm_motor->base.del = bdc_motor_mcpwm_del;
     *ret_motor = &mcpwm_motor->base;
     return ESP_OK;
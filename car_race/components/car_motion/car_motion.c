@@ -2,16 +2,23 @@
 
 
 #include "stdio.h"
+#include "math.h"
 
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "motor.h"
+#include "encoder.h"
 
 
 car_motion_t micro_car;
 
+// 编码器里程计
+// Encoder odometry
+static car_odom_t odom = {0};
+static int odom_last_count[MOTOR_MAX_NUM] = {0};
+
 // // 线速度和角速度
 // static float line_v = 0;
 // static float angular_v = 0;
@@ -21,6 +28,80 @@ static float speed_L2_setup = 0;
 static float speed_R1_setup = 0;
 static float speed_R2_setup = 0;
 
+// 底盘速度外环：使能标志和Vx、Wz的积分项
+// Chassis velocity outer loop: enable flag and the integral terms of Vx and Wz
+static volatile bool chassis_ctrl_enable = false;
+static float chassis_i_vx = 0;
+static float chassis_i_wz = 0;
+
+// 麦克纳姆轮正运动学，四轮速度(L1、L2、R1、R2)转换为底盘速度
+// Mecanum forward kinematics, converts the four wheel speeds (L1, L2, R1, R2) to the chassis speed
+static void Motion_Forward_Kinematics(const float *wheel, car_motion_t *car)
+{
+    car->Vx = (wheel[0] + wheel[1] + wheel[2] + wheel[3]) / 4.0f;
+    car->Vy = (-wheel[0] + wheel[1] + wheel[2] - wheel[3]) / 4.0f;
+    car->Wz = (-wheel[0] - wheel[1] + wheel[2] + wheel[3]) / 4.0f / ROBOT_APB;
+}
+
+// 麦克纳姆轮逆运动学，底盘速度转换为四轮速度。超出电机最大速度时整体等比例缩小，保持转弯半径不变
+// Mecanum inverse kinematics, converts the chassis speed to the four wheel speeds. Scaled down as a whole when beyond the maximum motor speed, keeping the turn radius
+static void Motion_Inverse_Kinematics(float V_x, float V_y, float V_z, float *wheel)
+{
+    float angular_component = V_z * ROBOT_APB;
+    wheel[0] = V_x - V_y - angular_component;
+    wheel[1] = V_x + V_y - angular_component;
+    wheel[2] = V_x + V_y + angular_component;
+    wheel[3] = V_x - V_y + angular_component;
+
+    float peak = 0;
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        if (fabsf(wheel[i]) > peak) peak = fabsf(wheel[i]);
+    }
+    if (peak > MOTOR_MAX_SPEED)
+    {
+        float scale = MOTOR_MAX_SPEED / peak;
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            wheel[i] *= scale;
+        }
+    }
+}
+
+// 底盘速度外环，作为电机控制周期钩子运行在Motor_Task中：
+// 由四轮设定速度反算底盘指令速度，由四轮实测速度得到底盘实际速度，对Vx和Wz做PI修正后重新分配到四个轮子
+// Chassis velocity outer loop, runs in Motor_Task as the motor control period hook:
+// the commanded chassis speed comes back from the four wheel setpoints, the actual chassis speed from the measured wheel speeds,
+// Vx and Wz get a PI correction and are distributed to the four wheels again
+static void Motion_Chassis_Ctrl(const float *wheel_speed, float *wheel_setpoint, float dt, void *arg)
+{
+    car_motion_t target, actual;
+    Motion_Forward_Kinematics(wheel_setpoint, &target);
+    Motion_Forward_Kinematics(wheel_speed, &actual);
+
+    // 停车指令或外环关闭时清除积分
+    // Clear the integrals on a stop command or when the outer loop is off
+    if (!chassis_ctrl_enable || (target.Vx == 0 && target.Vy == 0 && target.Wz == 0))
+    {
+        chassis_i_vx = 0;
+        chassis_i_wz = 0;
+        return;
+    }
+
+    float error_vx = target.Vx - actual.Vx;
+    float error_wz = target.Wz - actual.Wz;
+    chassis_i_vx += MOTION_CHASSIS_KI_V * error_vx * dt;
+    chassis_i_wz += MOTION_CHASSIS_KI_W * error_wz * dt;
+    if (chassis_i_vx > MOTION_CHASSIS_I_MAX_V) chassis_i_vx = MOTION_CHASSIS_I_MAX_V;
+    if (chassis_i_vx < -MOTION_CHASSIS_I_MAX_V) chassis_i_vx = -MOTION_CHASSIS_I_MAX_V;
+    if (chassis_i_wz > MOTION_CHASSIS_I_MAX_W) chassis_i_wz = MOTION_CHASSIS_I_MAX_W;
+    if (chassis_i_wz < -MOTION_CHASSIS_I_MAX_W) chassis_i_wz = -MOTION_CHASSIS_I_MAX_W;
+
+    float vx = target.Vx + MOTION_CHASSIS_KP_V * error_vx + chassis_i_vx;
+    float wz = target.Wz + MOTION_CHASSIS_KP_W * error_wz + chassis_i_wz;
+    Motion_Inverse_Kinematics(vx, target.Vy, wz, wheel_setpoint);
+}
+
 
 // 小车停止 Car stop
 void Motion_Stop(uint8_t brake)
@@ -43,23 +124,19 @@ void Motion_Ctrl(float V_x, float V_y, float V_z)
     
     // V_x: [-1.0, 1.0], V_y: [-1.0, 1.0], V_z: [-5.0, 5.0]
 
-    float angular_component = V_z * ROBOT_APB;
-
     // 麦克纳姆轮运动学公式
     // 注意：V_y 的加减号取决于你的电机安装方向和轮子滚轮方向（O型安装 vs X型安装）
     // 以下是标准的 O型长方形底盘 且 想要向左平移时的公式 (视 V_y 正负而定)
-    
     // 左前轮 (L1) = Vx - Vy - Vz
-    speed_L1_setup = V_x - V_y - angular_component;
-    
     // 左后轮 (L2) = Vx + Vy - Vz
-    speed_L2_setup = V_x + V_y - angular_component;
-    
     // 右前轮 (R1) = Vx + Vy + Vz
-    speed_R1_setup = V_x + V_y + angular_component;
-    
     // 右后轮 (R2) = Vx - Vy + Vz
-    speed_R2_setup = V_x - V_y + angular_component;
+    float wheel[MOTOR_MAX_NUM] = {0};
+    Motion_Inverse_Kinematics(V_x, V_y, V_z, wheel);
+    speed_L1_setup = wheel[0];
+    speed_L2_setup = wheel[1];
+    speed_R1_setup = wheel[2];
+    speed_R2_setup = wheel[3];
 
     // 发送给电机
     Motor_Set_Speed(speed_L1_setup, speed_L2_setup, speed_R1_setup, speed_R2_setup);
@@ -69,15 +146,190 @@ void Motion_Ctrl(float V_x, float V_y, float V_z)
 // Get the speed of the car's motion
 void Motion_Get_Speed(car_motion_t* car)
 {
-    float speed_m1 = 0, speed_m2 = 0, speed_m3 = 0, speed_m4 = 0;
-    Motor_Get_Speed(&speed_m1, &speed_m2, &speed_m3, &speed_m4);
-
-    car->Vx = (speed_m1 + speed_m2 + speed_m3 + speed_m4) / 4;
-    car->Vy = 0;
-    car->Wz = -(speed_m1 + speed_m2 - speed_m3 - speed_m4) / 4.0f / ROBOT_APB;
+    motor_speed_snapshot_t snapshot;
+    Motor_Get_Speed_Snapshot(&snapshot);
+    Motion_Forward_Kinematics(snapshot.speed, car);
     if(car->Wz == 0) car->Wz = 0;
 }
 
+// 初始化速度规划：在distance内从v_start加速到v_max，并以v_exit到达终点
+// Initialize the motion profile: accelerate from v_start to v_max within distance and arrive at the end with v_exit
+void Motion_Profile_Init(motion_profile_t* profile, float distance, float v_max, float a_max, float j_max, float v_start, float v_exit)
+{
+    profile->distance = distance;
+    profile->v_max = v_max;
+    profile->a_max = a_max;
+    profile->j_max = j_max;
+    profile->v_exit = (v_exit < v_max) ? v_exit : v_max;
+    profile->pos = 0;
+    profile->vel = (v_start > 0) ? v_start : 0;
+    profile->acc = 0;
+    profile->done = (distance <= 0);
+}
+
+// 推进速度规划dt秒，travelled为实测已行驶距离（小于0时使用规划位置），返回速度设定值
+// Advance the motion profile by dt seconds, travelled is the measured distance (planned position is used if negative), returns the speed setpoint
+float Motion_Profile_Update(motion_profile_t* profile, float dt, float travelled)
+{
+    if (travelled >= 0) profile->pos = travelled;
+    float remain = profile->distance - profile->pos;
+    if (profile->done || remain <= 0 || dt <= 0)
+    {
+        if (remain <= 0) profile->done = true;
+        if (profile->done) profile->vel = profile->v_exit;
+        return profile->vel;
+    }
+
+    // 加加速度受限时减速度需要时间建立，提前留出这段距离
+    // With limited jerk the deceleration takes time to build up, reserve that distance in advance
+    float brake_remain = remain;
+    if (profile->j_max > 0)
+    {
+        brake_remain -= profile->vel * profile->a_max / profile->j_max / 2.0f;
+        if (brake_remain < 0) brake_remain = 0;
+    }
+
+    // 以最大减速度刹车到v_exit所允许的最大速度
+    // Maximum speed that still allows braking to v_exit at the maximum deceleration
+    float v_brake = sqrtf(profile->v_exit * profile->v_exit + 2.0f * profile->a_max * brake_remain);
+    float v_target = (v_brake < profile->v_max) ? v_brake : profile->v_max;
+    if (v_target < MOTION_PROFILE_V_MIN) v_target = MOTION_PROFILE_V_MIN;
+
+    float acc = (v_target - profile->vel) / dt;
+    if (acc > profile->a_max) acc = profile->a_max;
+    if (acc < -profile->a_max) acc = -profile->a_max;
+    if (profile->j_max > 0)
+    {
+        float da = profile->j_max * dt;
+        if (acc > profile->acc + da) acc = profile->acc + da;
+        if (acc < profile->acc - da) acc = profile->acc - da;
+    }
+    profile->acc = acc;
+    profile->vel += acc * dt;
+    // 越过目标速度时停在目标速度上
+    // Stop at the target speed when crossing it
+    if ((acc > 0 && profile->vel > v_target) || (acc < 0 && profile->vel < v_target))
+    {
+        profile->vel = v_target;
+        profile->acc = 0;
+    }
+    if (profile->vel > profile->v_max) profile->vel = profile->v_max;
+    if (profile->vel < 0) profile->vel = 0;
+    if (travelled < 0) profile->pos += profile->vel * dt;
+    return profile->vel;
+}
+
+// 以当前编码器计数为起点清零里程计
+// Reset the odometry, taking the current encoder counts as the origin
+void Motion_Odom_Reset(void)
+{
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        odom_last_count[i] = Encoder_Get_Count(ENCODER_ID_M1 + i);
+    }
+    Motor_Take_Slip_Mask();
+    odom.distance = 0;
+    odom.heading = 0;
+    odom.slip = 0;
+}
+
+// 根据左右轮编码器增量积分路程和航向角，需要周期调用
+// Integrate distance and heading from the left/right encoder increments, must be called periodically
+void Motion_Odom_Update(void)
+{
+    float wheel[MOTOR_MAX_NUM] = {0};
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        int count = Encoder_Get_Count(ENCODER_ID_M1 + i);
+        wheel[i] = (count - odom_last_count[i]) * (MOTOR_WHEEL_CIRCLE / MOTOR_ENCODER_CIRCLE / 1000.0f);
+        odom_last_count[i] = count;
+    }
+
+    // 打滑轮子的增量不可信：只有一个轮子打滑时用刚体约束 L1 - L2 + R1 - R2 = 0 由其余三个轮子反算，
+    // 多个轮子打滑时用同侧未打滑的轮子代替
+    // The increment of a slipping wheel is not trusted: with one slipping wheel it is rebuilt from the other three
+    // by the rigid-body constraint L1 - L2 + R1 - R2 = 0, with more than one the non-slipping wheel on the same side is used
+    static const float c[MOTOR_MAX_NUM] = {1, -1, 1, -1};
+    uint8_t mask = Motor_Take_Slip_Mask();
+    if (mask)
+    {
+        float raw_sum = wheel[0] + wheel[1] + wheel[2] + wheel[3];
+        int slip_num = 0;
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            if (mask & (1 << i)) slip_num++;
+        }
+        float fixed[MOTOR_MAX_NUM];
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            fixed[i] = wheel[i];
+            if (!(mask & (1 << i))) continue;
+            if (slip_num == 1)
+            {
+                float sum = 0;
+                for (int j = 0; j < MOTOR_MAX_NUM; j++)
+                {
+                    if (j != i) sum += c[j] * wheel[j];
+                }
+                fixed[i] = -c[i] * sum;
+            }
+            else if (!(mask & (1 << (i ^ 1))))
+            {
+                fixed[i] = wheel[i ^ 1];
+            }
+        }
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            wheel[i] = fixed[i];
+        }
+        odom.slip += (raw_sum - (wheel[0] + wheel[1] + wheel[2] + wheel[3])) / 4.0f;
+    }
+
+    // M1、M2为左侧轮，M3、M4为右侧轮
+    // M1 and M2 are the left wheels, M3 and M4 are the right wheels
+    float left = (wheel[0] + wheel[1]) / 2.0f;
+    float right = (wheel[2] + wheel[3]) / 2.0f;
+    odom.distance += (left + right) / 2.0f;
+    odom.heading += (right - left) / 2.0f / ROBOT_APB;
+}
+
+// 读取里程计
+// Read the odometry
+void Motion_Get_Odom(car_odom_t* out)
+{
+    *out = odom;
+}
+
+// 打开或关闭底盘速度外环
+// Enable or disable the chassis velocity outer loop
+void Motion_Set_Chassis_Ctrl(bool enable)
+{
+    chassis_ctrl_enable = enable;
+}
+
+// 小车按位置环移动：向前x(m)、向左y(m)、左转yaw(rad)，max_speed为最远轮子的限速(m/s)，max_accel为其加速度上限(m/s^2)，
+// 四个轮子同时到位，到位后向task发送notify_bits通知并停在目标位置，直到下一条运动指令
+// Move the car with the position loop: x forward (m), y to the left (m), yaw to the left (rad); max_speed is the speed limit of the farthest wheel (m/s),
+// max_accel its acceleration limit (m/s^2); the four wheels arrive together, notify_bits are sent to task on arrival and the car holds the position until the next motion command
+void Motion_Move(float x, float y, float yaw, float max_speed, float max_accel, TaskHandle_t task, uint32_t notify_bits)
+{
+    float arc = yaw * ROBOT_APB;
+    float wheel[MOTOR_MAX_NUM] = {
+        x - y - arc,
+        x + y - arc,
+        x + y + arc,
+        x - y + arc,
+    };
+    Motor_Move_Distance(wheel, max_speed, max_accel, task, notify_bits);
+}
+
+// 最近一次Motion_Move是否已经到位
+// Whether the last Motion_Move has arrived
+bool Motion_Move_Done(void)
+{
+    return Motor_Move_Done();
+}
+
 // 控制小车的运动状态
 // Control the motion state of the car
 void Motion_Ctrl_State(uint8_t state, float speed)
@@ -114,3 +366,11 @@ void Motion_Ctrl_State(uint8_t state, float speed)
         break;
     }
 }
+
+// 初始化小车运动控制，在Motor_Init之后调用，注册底盘速度外环
+// Initialize the car motion control, called after Motor_Init, registers the chassis velocity outer loop
+void Motion_Init(void)
+{
+    Motor_Set_Ctrl_Hook(Motion_Chassis_Ctrl, NULL);
+    Motion_Set_Chassis_Ctrl(true);
+}
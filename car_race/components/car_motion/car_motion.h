@@ -5,6 +5,7 @@ extern "C" {
 #endif
 
 #include "stdint.h"
+#include "stdbool.h"
 #include "motor.h"
 
 // 小车底盘轮子间距，单位:m
@@ -22,6 +23,19 @@ extern "C" {
 
 #define ROBOT_SPIN_SCALE             (5.0f)
 
+// 底盘速度外环PI参数，修正线速度Vx和角速度Wz，积分项限幅单位：m/s、rad/s
+// Chassis velocity outer loop PI parameters, corrects the linear speed Vx and the angular speed Wz, integral limits unit: m/s, rad/s
+#define MOTION_CHASSIS_KP_V          (0.3f)
+#define MOTION_CHASSIS_KI_V          (2.0f)
+#define MOTION_CHASSIS_I_MAX_V       (0.1f)
+#define MOTION_CHASSIS_KP_W          (0.3f)
+#define MOTION_CHASSIS_KI_W          (2.0f)
+#define MOTION_CHASSIS_I_MAX_W       (0.5f)
+
+// 速度规划的最小爬行速度，防止末速度为0时在终点前停住，单位：m/s
+// Minimum creep speed of the motion profile, prevents stalling before the end when the exit speed is 0, unit: m/s
+#define MOTION_PROFILE_V_MIN         (0.05f)
+
 
 typedef enum _motion_state {
     MOTION_STOP = 0,
@@ -45,12 +59,49 @@ typedef struct _car_motion
     float Wz;
 } car_motion_t;
 
+// 编码器里程计，distance单位：m，heading单位：rad，左转为正，slip为打滑轮子多转出的路程(m)，已从distance中扣除
+// Encoder odometry, distance unit: m, heading unit: rad, left turn is positive,
+// slip is the extra distance turned by slipping wheels (m), already taken out of distance
+typedef struct _car_odom
+{
+    float distance;
+    float heading;
+    float slip;
+} car_odom_t;
+
+
+
+// 直线速度规划器（梯形，j_max>0时为S曲线），单位：m、m/s、m/s^2、m/s^3
+// Straight line motion profile (trapezoidal, S-curve when j_max>0), unit: m, m/s, m/s^2, m/s^3
+typedef struct _motion_profile
+{
+    float distance;
+    float v_max;
+    float a_max;
+    float j_max;
+    float v_exit;
+    float pos;
+    float vel;
+    float acc;
+    bool done;
+} motion_profile_t;
+
 
 
 void Motion_Stop(uint8_t brake);
 void Motion_Ctrl(float V_x, float V_y, float V_z);
 void Motion_Ctrl_State(uint8_t state, float speed);
+void Motion_Move(float x, float y, float yaw, float max_speed, float max_accel, TaskHandle_t task, uint32_t notify_bits);
+bool Motion_Move_Done(void);
 void Motion_Get_Speed(car_motion_t* car);
+void Motion_Set_Chassis_Ctrl(bool enable);
+
+void Motion_Profile_Init(motion_profile_t* profile, float distance, float v_max, float a_max, float j_max, float v_start, float v_exit);
+float Motion_Profile_Update(motion_profile_t* profile, float dt, float travelled);
+
+void Motion_Odom_Reset(void);
+void Motion_Odom_Update(void);
+void Motion_Get_Odom(car_odom_t* odom);
 
 
 void Motion_Init(void);
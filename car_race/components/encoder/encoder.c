@@ -18,6 +18,18 @@ pcnt_unit_handle_t encoder_unit_m2;
 pcnt_unit_handle_t encoder_unit_m3;
 pcnt_unit_handle_t encoder_unit_m4;
 
+// 平均脉冲数阈值事件：在PCNT中断里检查，接近阈值时通知任务。中断可能在另一个核上运行，arm_*都在arm_lock保护下读写
+// Average pulse threshold event: checked in the PCNT interrupt, notifies the task when the threshold is near.
+// The interrupt may run on the other core, every arm_* is read and written under arm_lock
+static portMUX_TYPE arm_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool arm_active = false;
+static int arm_target = 0;
+static TaskHandle_t arm_task = NULL;
+static uint32_t arm_notify_bits = 0;
+static int arm_watch_point[4] = {0};
+
+static bool Encoder_On_Reach(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *user_ctx);
+
 // 初始化电机1编码器，绑定GPIO并配置PCNT计数器。
 // Initialize motor 1 encoder, bind GPIO and configure PCNT counter.
 static void Encoder_M1_Init(void)
@@ -51,6 +63,10 @@ static void Encoder_M1_Init(void)
     ESP_ERROR_CHECK(pcnt_channel_set_level_action(pcnt_chan_b, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_HIGH_LIMIT));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_LOW_LIMIT));
+    pcnt_event_callbacks_t cbs = {
+        .on_reach = Encoder_On_Reach,
+    };
+    ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(pcnt_unit, &cbs, NULL));
     ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit));
@@ -90,6 +106,10 @@ static void Encoder_M2_Init(void)
     ESP_ERROR_CHECK(pcnt_channel_set_level_action(pcnt_chan_b, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_HIGH_LIMIT));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_LOW_LIMIT));
+    pcnt_event_callbacks_t cbs = {
+        .on_reach = Encoder_On_Reach,
+    };
+    ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(pcnt_unit, &cbs, NULL));
     ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit));
@@ -129,6 +149,10 @@ static void Encoder_M3_Init(void)
     ESP_ERROR_CHECK(pcnt_channel_set_level_action(pcnt_chan_b, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_HIGH_LIMIT));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_LOW_LIMIT));
+    pcnt_event_callbacks_t cbs = {
+        .on_reach = Encoder_On_Reach,
+    };
+    ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(pcnt_unit, &cbs, NULL));
     ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit));
@@ -168,6 +192,10 @@ static void Encoder_M4_Init(void)
     ESP_ERROR_CHECK(pcnt_channel_set_level_action(pcnt_chan_b, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_HIGH_LIMIT));
     ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, ENCODER_PCNT_LOW_LIMIT));
+    pcnt_event_callbacks_t cbs = {
+        .on_reach = Encoder_On_Reach,
+    };
+    ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(pcnt_unit, &cbs, NULL));
     ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
     ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit));
@@ -221,6 +249,144 @@ int Encoder_Get_Count(uint8_t encoder_id)
     return 0;
 }
 
+// 获取四个电机累计编码器脉冲数量的平均值
+// Get the average cumulative number of encoder pulses of the four motors
+int Encoder_Get_Count_Average(void)
+{
+    int total_pulse = Encoder_Get_Count_M1() + Encoder_Get_Count_M2() +
+                      Encoder_Get_Count_M3() + Encoder_Get_Count_M4();
+    return total_pulse / 4;
+}
+
+// 清零四个电机的编码器脉冲计数
+// Clear the encoder pulse count of the four motors
+void Encoder_Clear_Count_All(void)
+{
+    if (encoder_unit_m1 != NULL) pcnt_unit_clear_count(encoder_unit_m1);
+    if (encoder_unit_m2 != NULL) pcnt_unit_clear_count(encoder_unit_m2);
+    if (encoder_unit_m3 != NULL) pcnt_unit_clear_count(encoder_unit_m3);
+    if (encoder_unit_m4 != NULL) pcnt_unit_clear_count(encoder_unit_m4);
+}
+
+static pcnt_unit_handle_t Encoder_Get_Unit(int index)
+{
+    if (index == 0) return encoder_unit_m1;
+    if (index == 1) return encoder_unit_m2;
+    if (index == 2) return encoder_unit_m3;
+    return encoder_unit_m4;
+}
+
+// PCNT观察点中断回调：在阈值观察点和溢出点上检查四轮平均脉冲数，进入提前量内才通知任务。
+// 最慢的轮子走到自己的观察点时平均值一定已进入提前量，快的轮子先到时平均值够了也会提前通知
+// PCNT watch point interrupt callback: checks the four-wheel average at the threshold and overflow watch points, the task is only
+// notified once the average is within the margin. By the time the slowest wheel reaches its point the average is always within it,
+// a faster wheel arriving first also notifies if the average is already there
+static bool Encoder_On_Reach(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *user_ctx)
+{
+    int total = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int count = 0;
+        pcnt_unit_get_count(Encoder_Get_Unit(i), &count);
+        total += count;
+    }
+
+    TaskHandle_t task = NULL;
+    uint32_t notify_bits = 0;
+    portENTER_CRITICAL_ISR(&arm_lock);
+    if (arm_active && total / 4 >= arm_target - ENCODER_ARM_MARGIN)
+    {
+        arm_active = false;
+        task = arm_task;
+        notify_bits = arm_notify_bits;
+    }
+    portEXIT_CRITICAL_ISR(&arm_lock);
+    if (task == NULL) return false;
+
+    BaseType_t task_woken = pdFALSE;
+    xTaskNotifyFromISR(task, notify_bits, eSetBits, &task_woken);
+    return task_woken == pdTRUE;
+}
+
+// 设置四轮平均脉冲数阈值。累计平均脉冲数距离target不足ENCODER_ARM_MARGIN时在中断里给task发送notify_bits通知，
+// 之后由调用方轮询Encoder_Get_Count_Average()直到真正达到target。
+// 观察点只能放在计数器下一次归零之前，距离阈值还超过一圈(ENCODER_PCNT_HIGH_LIMIT)时不设置，返回false，调用方需在之后重新设置
+// Arm a four-wheel average pulse threshold. task gets notify_bits from the interrupt once the average cumulative count is less than
+// ENCODER_ARM_MARGIN short of target, the caller then polls Encoder_Get_Count_Average() up to target.
+// A watch point can only sit before the next wrap of the unit, so nothing is armed and false is returned while the threshold is still
+// more than one wrap (ENCODER_PCNT_HIGH_LIMIT) away, the caller has to arm again later
+bool Encoder_Arm_Average(int target, TaskHandle_t task, uint32_t notify_bits)
+{
+    Encoder_Disarm_Average();
+
+    int count[4] = {0};
+    int total = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        pcnt_unit_get_count(Encoder_Get_Unit(i), &count[i]);
+        total += count[i];
+    }
+
+    // 已经进入提前量，直接通知
+    // Already within the margin, notify directly
+    int remain = target - total / 4;
+    if (remain <= ENCODER_ARM_MARGIN)
+    {
+        xTaskNotify(task, notify_bits, eSetBits);
+        return true;
+    }
+    if (remain - ENCODER_ARM_MARGIN >= ENCODER_PCNT_HIGH_LIMIT) return false;
+
+    // 每个计数器在自己预计走到阈值前ENCODER_ARM_MARGIN的位置放一个观察点，计数器每满ENCODER_PCNT_HIGH_LIMIT会归零，所以取余数。
+    // 观察点在未激活时添加，中断看不到添加到一半的状态
+    // Each unit gets a watch point ENCODER_ARM_MARGIN before it is expected to reach the threshold, the unit wraps every
+    // ENCODER_PCNT_HIGH_LIMIT so take the remainder. The watch points are added while disarmed, the interrupt never sees a half-armed state
+    int watch_point[4] = {0};
+    for (int i = 0; i < 4; i++)
+    {
+        int point = (count[i] + remain - ENCODER_ARM_MARGIN) % ENCODER_PCNT_HIGH_LIMIT;
+        if (point == 0) continue;
+        if (pcnt_unit_add_watch_point(Encoder_Get_Unit(i), point) == ESP_OK)
+        {
+            watch_point[i] = point;
+        }
+    }
+
+    portENTER_CRITICAL(&arm_lock);
+    arm_task = task;
+    arm_notify_bits = notify_bits;
+    arm_target = target;
+    for (int i = 0; i < 4; i++)
+    {
+        arm_watch_point[i] = watch_point[i];
+    }
+    arm_active = true;
+    portEXIT_CRITICAL(&arm_lock);
+    return true;
+}
+
+// 取消平均脉冲数阈值
+// Disarm the average pulse threshold
+void Encoder_Disarm_Average(void)
+{
+    // 先在锁内停用并取走观察点，再在锁外删除，中断不会再使用正在删除的观察点
+    // Deactivate and take the watch points under the lock first, then remove them outside it, the interrupt never uses a point being removed
+    int watch_point[4] = {0};
+    portENTER_CRITICAL(&arm_lock);
+    arm_active = false;
+    for (int i = 0; i < 4; i++)
+    {
+        watch_point[i] = arm_watch_point[i];
+        arm_watch_point[i] = 0;
+    }
+    portEXIT_CRITICAL(&arm_lock);
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (watch_point[i] != 0) pcnt_unit_remove_watch_point(Encoder_Get_Unit(i), watch_point[i]);
+    }
+}
+
 // 初始化电机编码器
 // Initialize the motor encoder
 void Encoder_Init(void)
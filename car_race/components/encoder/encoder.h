@@ -5,6 +5,10 @@ extern "C" {
 #endif
 
 #include "stdint.h"
+#include "stdbool.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #define ENCODER_GPIO_H1A            6
 #define ENCODER_GPIO_H1B            7
@@ -23,6 +27,10 @@ extern "C" {
 #define ENCODER_PCNT_HIGH_LIMIT   1000
 #define ENCODER_PCNT_LOW_LIMIT    -1000
 
+// 平均脉冲数阈值的提前量：平均脉冲数距离阈值不足该值时就通知，剩余部分由调用方轮询完成
+// Lead of the average pulse threshold: notify once the average is less than this many pulses short of it, the caller polls the rest
+#define ENCODER_ARM_MARGIN        40
+
 
 typedef enum _encoder_id 
 {
@@ -40,6 +48,11 @@ int Encoder_Get_Count_M2(void);
 int Encoder_Get_Count_M3(void);
 int Encoder_Get_Count_M4(void);
 int Encoder_Get_Count(uint8_t encoder_id);
+int Encoder_Get_Count_Average(void);
+void Encoder_Clear_Count_All(void);
+
+bool Encoder_Arm_Average(int target, TaskHandle_t task, uint32_t notify_bits);
+void Encoder_Disarm_Average(void);
 
 #ifdef __cplusplus
 }
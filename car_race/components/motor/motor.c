@@ -1,47 +1,285 @@
 #include "motor.h"
 
 #include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include "stdatomic.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 
 #include "driver/pulse_cnt.h"
+#include "driver/gptimer.h"
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "esp_cpu.h"
+#include "nvs.h"
 
 
 #include "pwm_motor.h"
 #include "encoder.h"
 #include "pid_ctrl.h"
+#include "pid_bank.h"
 
 
 
 static const char *TAG = "MOTOR";
 
+#if (MOTOR_CTRL_RATE_HZ > 1000) || ((MOTOR_CTRL_RATE_HZ * MOTOR_PID_PERIOD) % 1000 != 0)
+#error "MOTOR_CTRL_RATE_HZ must be a multiple of 1000/MOTOR_PID_PERIOD and no more than 1000"
+#endif
+#if !MOTOR_CTRL_USE_TIMER && (1000 % MOTOR_CTRL_RATE_HZ != 0)
+#error "MOTOR_CTRL_RATE_HZ must divide 1000 when the control loop runs on the system tick"
+#endif
 
-// 10毫秒目标脉冲数
-// 10 ms target pulse number
-static float speed_count[MOTOR_MAX_NUM] = {0};
+// 每个参考周期包含的控制周期数
+// Number of control periods per reference period
+#define MOTOR_CTRL_STEPS        (MOTOR_CTRL_RATE_HZ * MOTOR_PID_PERIOD / 1000)
 
-// 通过编码器计算得到电机速度，单位:m/s
-// The motor speed is calculated by the encoder, unit :m/s
+// 轮速PID算法类型：PID_CAL_TYPE_2DOF 或 PID_CAL_TYPE_INCREMENTAL
+// Wheel speed PID calculation type: PID_CAL_TYPE_2DOF or PID_CAL_TYPE_INCREMENTAL
+#define MOTOR_PID_CAL_TYPE      PID_CAL_TYPE_2DOF
+
+// 2DOF时四个轮子可由PID组批量计算：启动时在目标上用CPU周期数比较PID组和四个独立PID控制块，取较快的一种，结果打印在启动日志里
+// With 2DOF the four wheels may run as one PID bank: at startup the bank and four separate PID control blocks are timed in CPU cycles
+// on the target and the faster one is used, the result is printed in the boot log
+#define MOTOR_PID_BENCHMARK_LOOPS   (1000)
+#define MOTOR_PID_BENCHMARK_ROUNDS  (3)
+
+// 2DOF PID：比例项和微分项的设定值权重，微分滤波时间常数和反算抗饱和时间常数，单位：ms
+// 2DOF PID: setpoint weights of the proportional and derivative terms, derivative filter and back-calculation time constants, unit: ms
+#define MOTOR_PID_BETA          (0.6f)
+#define MOTOR_PID_GAMMA         (0.0f)
+#define MOTOR_PID_D_FILTER_MS   (5.0f)
+#define MOTOR_PID_TRACK_MS      (20.0f)
+
+// 打滑检测：刚体约束残差阈值(m/s)，实测加速度超出指令加速度的阈值(m/s^2)，加速度滤波带宽(Hz)，
+// 残差消失后标志保持时间(ms)，打滑时出力每秒变化上限(参考出力/s)
+// Slip detection: rigid-body constraint residual threshold (m/s), threshold of the measured acceleration beyond the commanded one (m/s^2),
+// acceleration filter bandwidth (Hz), flag hold time after the residual is gone (ms), effort ramp limit while slipping (reference effort/s)
+#define MOTOR_SLIP_RESIDUAL     (0.08f)
+#define MOTOR_SLIP_ACCEL        (2.0f)
+#define MOTOR_SLIP_ACCEL_BW_HZ  (20)
+#define MOTOR_SLIP_HOLD_MS      (30)
+#define MOTOR_SLIP_RAMP         (400.0f)
+
+// 位置环：末段线性区增益(1/s)，到位的位置误差(m)和速度(m/s)，保持到位多久才算完成(ms)，
+// 同步运动时距离较短的轮子限速比例下限
+// Position loop: gain of the final linear region (1/s), position error (m) and speed (m/s) counted as on target,
+// how long it must stay on target before completion (ms), lower bound of the speed scale of shorter wheels in a synchronised move
+#define MOTOR_MOVE_KP           (8.0f)
+#define MOTOR_MOVE_POS_TOL      (0.002f)
+#define MOTOR_MOVE_VEL_TOL      (0.02f)
+#define MOTOR_MOVE_SETTLE_MS    (20)
+#define MOTOR_MOVE_MIN_SCALE    (0.05f)
+
+// 单个控制周期内允许的最大脉冲增量，超过时认为编码器计数被清零
+// Maximum pulse increment in one control period, beyond it the encoder count is considered cleared
+#define MOTOR_PULSE_GATE        ((int)(4 * MOTOR_MAX_SPEED * MOTOR_ENCODER_CIRCLE / MOTOR_WHEEL_CIRCLE * MOTOR_CTRL_PERIOD_US / 1000) + 4)
+
+// 控制周期与参考周期之比，用于换算PID参数
+// Ratio of the control period to the reference period, used to scale the PID parameters
+#define MOTOR_CTRL_RATIO        (MOTOR_CTRL_PERIOD_US / (MOTOR_PID_PERIOD * 1000.0f))
+
+
+// 控制命令：四个轮子的目标、前馈使用的设定速度和加速度、使能和停止方式，由比赛任务一次性发布
+// Control command: targets of the four wheels, setpoint speed and acceleration for the feed-forward, enable and stop mode, published at once by the race task
+typedef struct _motor_cmd
+{
+    float target[MOTOR_MAX_NUM];    // 参考周期(10毫秒)目标脉冲数 Target pulses per reference period (10 ms)
+    float speed[MOTOR_MAX_NUM];     // 设定速度 Setpoint speed, m/s
+    float accel[MOTOR_MAX_NUM];     // 设定加速度 Setpoint acceleration, m/s^2
+    bool enable;
+    bool brake;
+    int64_t time_us;
+    bool move;                          // 位置模式，忽略target/speed/accel Position mode, target/speed/accel are ignored
+    uint32_t move_id;                   // 每次移动指令递增 Incremented by every move command
+    float move_distance[MOTOR_MAX_NUM]; // 移动距离 Move distance, m
+    float move_speed;                   // 最大速度 Max speed, m/s
+    float move_accel;                   // 最大加速度 Max acceleration, m/s^2
+    TaskHandle_t move_task;             // 完成时通知的任务 Task notified on completion
+    uint32_t move_bits;                 // 通知位 Notification bits
+} motor_cmd_t;
+
+// 命令邮箱和速度快照都是双缓冲：写方写另一块缓冲后把序号加一完成切换，读方读序号指向的缓冲，序号前后不一致时重读。
+// 各自只有一个写方(命令：比赛任务，速度：Motor_Task)，两边都不加锁，写方之间不能互相抢占。
+// 读方抢占了正在写的写方时(同核高优先级任务或中断)，写方写的是另一块缓冲，读方一次读完，不会空转等写方，
+// 所以读写双方的核和优先级可以任意分配；只有读的过程中写方完成了一次完整写入才会重读
+// The command mailbox and the speed snapshot are double buffered: the writer fills the other buffer and flips by incrementing the sequence,
+// the reader reads the buffer the sequence points at and retries when the sequence changed. Each has a single writer (command: race task,
+// speed: Motor_Task), neither side takes a lock and writers must not preempt each other.
+// A reader preempting a writer mid-write (a higher priority task on the same core or an interrupt) finds the writer on the other buffer
+// and reads in one pass instead of spinning on it, so any core and priority assignment of readers and writers works; a reader only
+// retries when a complete write finished during its copy
+static motor_cmd_t cmd_mailbox[2] = {0};
+static atomic_uint cmd_seq = 0;
+static motor_speed_snapshot_t speed_mailbox[2] = {0};
+static atomic_uint speed_seq = 0;
+
+// 通过编码器计算得到电机速度，单位:m/s，只在Motor_Task中使用
+// The motor speed is calculated by the encoder, unit :m/s, only used in Motor_Task
 static float read_speed[MOTOR_MAX_NUM] = {0};
 
+// 前馈加速度的最大值，单位：m/s^2，过滤设定值阶跃产生的尖峰
+// Maximum feed-forward acceleration, unit: m/s^2, filters spikes caused by setpoint steps
+#define MOTOR_FF_ACCEL_MAX      (3.0f)
+// 两次设定速度间隔超过该值时不计算加速度，单位：s
+// No acceleration is computed when two speed settings are further apart than this, unit: s
+#define MOTOR_FF_ACCEL_DT_MAX   (0.1f)
+
+// 前馈标定：开环阶跃幅值(参考出力)，每个阶跃持续时间、静止时间和采样周期，单位：ms
+// Feed-forward calibration: open-loop step levels (reference effort), step duration, rest time and sampling period, unit: ms
+#define MOTOR_FF_CAL_STEP_NUM   (4)
+#define MOTOR_FF_CAL_STEP_MS    (800)
+#define MOTOR_FF_CAL_REST_MS    (400)
+#define MOTOR_FF_CAL_AVG_MS     (200)
+#define MOTOR_FF_CAL_SAMPLE_MS  (2)
+
+// NVS中前馈参数的版本号
+// Version of the feed-forward parameters in NVS
+#define MOTOR_FF_VERSION        (2)
+
+static const int ff_cal_level[MOTOR_FF_CAL_STEP_NUM] = {40, 80, 120, 160};
+
+// PWM线性化表标定：开环duty从0等分扫到最大值的级数，每级持续时间、取平均的时间和采样周期(ms)，判定起转的速度(m/s)
+// PWM linearization calibration: number of open-loop duty levels swept evenly from 0 to the maximum, duration of each level,
+// averaging time and sampling period (ms), speed taken as breakaway (m/s)
+#define MOTOR_LUT_CAL_LEVELS    (21)
+#define MOTOR_LUT_CAL_STEP_MS   (400)
+#define MOTOR_LUT_CAL_AVG_MS    (150)
+#define MOTOR_LUT_CAL_SAMPLE_MS (5)
+#define MOTOR_LUT_CAL_V_MIN     (0.03f)
+
+// NVS中线性化表的版本号
+// Version of the linearization table in NVS
+#define MOTOR_LUT_VERSION       (2)
+
+// PID自整定：继电器工作点速度(m/s)，无前馈时的偏置和继电器幅值(参考出力)，
+// 继电器回差(参考周期脉冲数)，整定时长、忽略的起振时长和采样周期(ms)
+// PID auto-tune: relay operating speed (m/s), bias without feed-forward and relay amplitude (reference effort),
+// relay hysteresis (pulses per reference period), tune duration, ignored start-up time and sampling period (ms)
+#define MOTOR_TUNE_SPEED        (0.4f)
+#define MOTOR_TUNE_BIAS         (60.0f)
+#define MOTOR_TUNE_RELAY        (40.0f)
+#define MOTOR_TUNE_HYSTERESIS   (1.0f)
+#define MOTOR_TUNE_MS           (3000)
+#define MOTOR_TUNE_SKIP_MS      (1000)
+#define MOTOR_TUNE_SAMPLE_MS    (1)
+#define MOTOR_TUNE_MIN_CYCLES   (3)
+
+// NVS中PID参数的版本号
+// Version of the PID parameters in NVS
+#define MOTOR_PID_VERSION       (1)
+
+// NVS中保存的每个轮子的PID参数(参考周期下的值)
+// PID parameters of each wheel stored in NVS (values at the reference period)
+typedef struct _motor_pid_blob
+{
+    uint32_t version;
+    float gain[MOTOR_MAX_NUM][3];
+} motor_pid_blob_t;
+
+// NVS中保存的每种衰减方式的前馈参数，duty_max用于PWM分辨率变化后换算
+// Feed-forward parameters of every decay mode stored in NVS, duty_max is used to rescale after the PWM resolution changes
+typedef struct _motor_ff_blob
+{
+    uint32_t version;
+    int32_t duty_max;
+    motor_ff_t ff[PWM_MOTOR_DECAY_MAX][MOTOR_MAX_NUM];
+} motor_ff_blob_t;
+
+// NVS中保存的每种衰减方式的PWM线性化表，duty_max用于PWM分辨率变化后换算
+// PWM linearization tables of every decay mode stored in NVS, duty_max is used to rescale after the PWM resolution changes
+typedef struct _motor_lut_blob
+{
+    uint32_t version;
+    int32_t duty_max;
+    uint16_t lut[PWM_MOTOR_DECAY_MAX][MOTOR_MAX_NUM][PWM_MOTOR_DIR_MAX][PWM_MOTOR_LUT_SIZE];
+} motor_lut_blob_t;
+
+// 每种衰减方式下每个轮子的前馈参数
+// Feed-forward parameters of each wheel in every decay mode
+static motor_ff_t motor_ff[PWM_MOTOR_DECAY_MAX][MOTOR_MAX_NUM] = {0};
+
+// 每个轮子的alpha-beta观测器：位置残差和速度估计(脉冲/控制周期)
+// Alpha-beta observer of each wheel: position residual and velocity estimate (pulses per control period)
+typedef struct _motor_observer
+{
+    float residual;
+    float velocity;
+} motor_observer_t;
+
+static motor_observer_t observer[MOTOR_MAX_NUM] = {0};
+static float observer_alpha = 0;
+static float observer_beta = 0;
+
 // PID参数结构体
 // PID parameter structure
 pid_ctrl_parameter_t pid_runtime_param = {0};
 
+// 每个轮子的PID参数(参考周期下的值)
+// PID parameters of each wheel (values at the reference period)
+static pid_ctrl_parameter_t pid_wheel_param[MOTOR_MAX_NUM] = {0};
+
 // PID电机控制器
 // PID motor controller
 pid_ctrl_block_handle_t pid_motor[MOTOR_MAX_NUM];
 
+// 四个轮子的PID组，与独立PID控制块使用相同参数，pid_use_bank为true时由它计算
+// PID bank of the four wheels, same parameters as the separate PID control blocks, it does the computation when pid_use_bank is true
+static pid_bank_handle_t pid_bank = NULL;
+static bool pid_use_bank = false;
+
 
 // PID计算后输出的速度值
 // PID Output speed value after calculation
 static float new_pid_output[MOTOR_MAX_NUM] = {0};
-static float pid_target[MOTOR_MAX_NUM] = {0};
-static float pid_enable = 0;
+
+// 麦克纳姆轮刚体约束 L1 - L2 + R1 - R2 = 0 的系数，四个轮子之和不为零说明有轮子打滑
+// Coefficients of the mecanum rigid-body constraint L1 - L2 + R1 - R2 = 0, a non-zero sum means a wheel is slipping
+static const float slip_sign[MOTOR_MAX_NUM] = {1, -1, 1, -1};
+
+// 打滑状态：加速度低通滤波系数，滤波后的实测加速度(m/s^2)，标志保持计数，里程计尚未取走的打滑标志
+// Slip state: acceleration low-pass coefficient, filtered measured acceleration (m/s^2), flag hold counters, slip flags not yet taken by the odometry
+static float slip_accel_k = 0;
+static float slip_accel[MOTOR_MAX_NUM] = {0};
+static int slip_hold[MOTOR_MAX_NUM] = {0};
+static atomic_uint slip_events = 0;
+
+// 位置环状态：控制周期内积分的轮子位置、目标位置(m)，位置环输出的设定速度(m/s)，各轮限速比例
+// Position loop state: wheel positions integrated in the control period and goal positions (m), setpoint speeds out of the position loop (m/s), per-wheel speed scales
+static float move_position[MOTOR_MAX_NUM] = {0};
+static float move_goal[MOTOR_MAX_NUM] = {0};
+static float move_speed[MOTOR_MAX_NUM] = {0};
+static float move_scale[MOTOR_MAX_NUM] = {0};
+static uint32_t move_active_id = 0;
+static int move_settle = 0;
+static bool move_notified = false;
+// 最近一次发布的移动指令编号(比赛任务)和已完成的移动指令编号(Motor_Task)
+// Id of the last published move command (race task) and of the last completed one (Motor_Task)
+static uint32_t move_id = 0;
+static atomic_uint move_done_id = 0;
+
+// 控制周期耗时(CPU周期)：Motor_PID_Ctrl整体和其中的PwmMotor_Set_Speed_All分开统计，平均值每秒由Motor_Task更新一次，最大值从上次复位起累计
+// Control period cost (CPU cycles): Motor_PID_Ctrl as a whole and the PwmMotor_Set_Speed_All inside it, the averages are updated
+// once a second by Motor_Task, the maxima accumulate since the last reset
+static uint32_t pwm_cycles = 0;
+static atomic_uint ctrl_cycles_avg = 0;
+static atomic_uint ctrl_cycles_max = 0;
+static atomic_uint pwm_cycles_avg = 0;
+static atomic_uint pwm_cycles_max = 0;
+
+// 控制周期钩子
+// Control period hook
+static volatile motor_ctrl_hook_t ctrl_hook = NULL;
+static void * volatile ctrl_hook_arg = NULL;
+
+// 控制循环任务和触发定时器
+// Control loop task and trigger timer
+static TaskHandle_t motor_task_handle = NULL;
+static gptimer_handle_t ctrl_timer = NULL;
 
 static float Motor_Limit_Speed(float speed)
 {
@@ -50,6 +288,233 @@ static float Motor_Limit_Speed(float speed)
     return speed;
 }
 
+// 按控制周期换算PID参数，外部设置的参数以MOTOR_PID_PERIOD和参考出力满量程为参考：
+// 积分项与周期成正比，微分项与周期成反比，比例项不变；三项都按实际出力满量程放大
+// Scale the PID parameters to the control period, externally set parameters refer to MOTOR_PID_PERIOD and the reference effort full scale:
+// the integral term is proportional to the period, the derivative term inversely proportional, the proportional term unchanged;
+// all three are scaled up to the actual effort full scale
+static void Motor_Apply_PID_Parm(void)
+{
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        pid_ctrl_parameter_t param = pid_wheel_param[i];
+        param.kp = pid_wheel_param[i].kp * PWM_MOTOR_EFFORT_SCALE;
+        param.ki = pid_wheel_param[i].ki * MOTOR_CTRL_RATIO * PWM_MOTOR_EFFORT_SCALE;
+        param.kd = pid_wheel_param[i].kd / MOTOR_CTRL_RATIO * PWM_MOTOR_EFFORT_SCALE;
+
+        // 积分范围保证积分项能够覆盖全部输出
+        // The integral range lets the integral term cover the full output
+        if (param.ki > 0)
+        {
+            param.max_integral = 2 * PWM_MOTOR_MAX_VALUE / param.ki;
+            param.min_integral = -param.max_integral;
+        }
+        pid_update_parameters(pid_motor[i], &param);
+        if (pid_bank != NULL) pid_bank_update_parameters(pid_bank, i, &param);
+    }
+}
+
+// 按带宽计算临界阻尼alpha-beta观测器增益
+// Compute the critically damped alpha-beta observer gains from the bandwidth
+static void Motor_Observer_Init(void)
+{
+    float theta = expf(-2.0f * (float)M_PI * MOTOR_OBSERVER_BW_HZ * MOTOR_CTRL_PERIOD_US / 1000000.0f);
+    observer_alpha = 1.0f - theta * theta;
+    observer_beta = (1.0f - theta) * (1.0f - theta);
+}
+
+// 观测器更新一个控制周期，输入本周期编码器脉冲增量，返回速度估计(脉冲/控制周期)
+// Advance the observer by one control period with the pulse increment of this period, returns the velocity estimate (pulses per control period)
+static float Motor_Observer_Update(motor_observer_t *obs, int pulse)
+{
+    // 预测位置前进velocity，残差为测量位置与预测位置之差
+    // The predicted position advances by velocity, the residual is the measured minus the predicted position
+    obs->residual += pulse - obs->velocity;
+    float r = obs->residual;
+    obs->residual -= observer_alpha * r;
+    obs->velocity += observer_beta * r;
+    return obs->velocity;
+}
+
+// 双缓冲写入：写序号未指向的缓冲，再把序号加一切换过去，只允许一个写方。buf为两块size大小的缓冲
+// Double buffer write: fill the buffer the sequence does not point at, then increment the sequence to flip to it, single writer only.
+// buf holds two buffers of size bytes
+static void Motor_Seqlock_Write(atomic_uint *seq, void *buf, const void *src, size_t size)
+{
+    unsigned int s = atomic_load_explicit(seq, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy((char *)buf + ((s + 1) & 1) * size, src, size);
+    atomic_store_explicit(seq, s + 1, memory_order_release);
+}
+
+// 双缓冲读取序号指向的缓冲，读的过程中发生了切换就重读(下一次写入可能正在覆盖刚读的缓冲)，返回读到的序号
+// Double buffer read of the buffer the sequence points at, retried when a flip happened during the copy (the next write may be
+// overwriting the buffer just read), returns the sequence that was read
+static unsigned int Motor_Seqlock_Read(atomic_uint *seq, void *dst, const void *buf, size_t size)
+{
+    unsigned int s1, s2;
+    do
+    {
+        s1 = atomic_load_explicit(seq, memory_order_acquire);
+        memcpy(dst, (const char *)buf + (s1 & 1) * size, size);
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(seq, memory_order_relaxed);
+    } while (s1 != s2);
+    return s1;
+}
+
+// 按当前衰减方式的参数计算一个轮子的前馈输出，单位：PWM ticks
+// Compute the feed-forward output of one wheel with the parameters of the current decay mode, unit: PWM ticks
+static float Motor_FF_Output(const motor_cmd_t *cmd, pwm_motor_decay_t decay, int index)
+{
+    float v = cmd->speed[index];
+    float a = cmd->accel[index];
+    const motor_ff_t *ff = &motor_ff[decay][index];
+
+    float output = ff->kv * v + ff->ka * a;
+    if (v > 0) output += ff->ks;
+    else if (v < 0) output -= ff->ks;
+    return output;
+}
+
+// 按带宽计算打滑检测的加速度滤波系数
+// Compute the acceleration filter coefficient of the slip detection from the bandwidth
+static void Motor_Slip_Init(void)
+{
+    slip_accel_k = 1.0f - expf(-2.0f * (float)M_PI * MOTOR_SLIP_ACCEL_BW_HZ * MOTOR_CTRL_PERIOD_US / 1000000.0f);
+}
+
+// 打滑检测，返回打滑轮子的掩码。
+// 四轮速度不满足刚体约束时，在比刚体速度转得更快的一侧轮子中，取实测加速度超出指令加速度最多的轮子判为打滑；
+// 约束残差保持同号期间持续标记该轮子。
+// Slip detection, returns the mask of the slipping wheels.
+// When the four wheel speeds break the rigid-body constraint, among the wheels turning faster than the rigid body,
+// the one whose measured acceleration exceeds the commanded acceleration the most is flagged; it stays flagged while the residual keeps its sign.
+static uint8_t Motor_Slip_Detect(const motor_cmd_t *cmd, bool enable)
+{
+    static float last_speed[MOTOR_MAX_NUM] = {0};
+    const float dt = MOTOR_CTRL_PERIOD_US / 1000000.0f;
+    const int hold_ticks = MOTOR_SLIP_HOLD_MS * 1000 / MOTOR_CTRL_PERIOD_US;
+
+    float residual = 0;
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        slip_accel[i] += slip_accel_k * ((read_speed[i] - last_speed[i]) / dt - slip_accel[i]);
+        last_speed[i] = read_speed[i];
+        residual += slip_sign[i] * read_speed[i];
+    }
+    if (!enable)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++) slip_hold[i] = 0;
+        return 0;
+    }
+
+    if (fabsf(residual) > MOTOR_SLIP_RESIDUAL)
+    {
+        int worst = -1;
+        float worst_excess = MOTOR_SLIP_ACCEL;
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            float dir = (read_speed[i] >= 0) ? 1.0f : -1.0f;
+            if (slip_sign[i] * residual * dir <= 0) continue;
+            // 已标记的轮子在残差同号时保持标记
+            // A flagged wheel stays flagged while the residual keeps its sign
+            if (slip_hold[i] > 0) slip_hold[i] = hold_ticks;
+            float excess = (slip_accel[i] - cmd->accel[i]) * dir;
+            if (excess > worst_excess)
+            {
+                worst = i;
+                worst_excess = excess;
+            }
+        }
+        if (worst >= 0) slip_hold[worst] = hold_ticks;
+    }
+
+    uint8_t mask = 0;
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        if (slip_hold[i] > 0)
+        {
+            mask |= 1 << i;
+            slip_hold[i]--;
+        }
+    }
+    if (mask) atomic_fetch_or_explicit(&slip_events, mask, memory_order_relaxed);
+    return mask;
+}
+
+// 位置环，级联在速度环之上：每个轮子的设定速度取最大速度、按最大加速度刚好停在目标处的速度和线性区速度中最小的一个，
+// 加速时按最大加速度限制变化；所有轮子的位置和速度保持在容差内MOTOR_MOVE_SETTLE_MS后通知完成，之后继续保持位置
+// Position loop cascaded over the speed loop: the setpoint speed of every wheel is the smallest of the max speed, the speed that just stops
+// on target at the max acceleration and the linear region speed, rising with at most the max acceleration; completion is notified once
+// every wheel has stayed within the position and speed tolerance for MOTOR_MOVE_SETTLE_MS, the position is held afterwards
+static void Motor_Move_Ctrl(motor_cmd_t *cmd)
+{
+    const float dt = MOTOR_CTRL_PERIOD_US / 1000000.0f;
+    const int settle_ticks = MOTOR_MOVE_SETTLE_MS * 1000 / MOTOR_CTRL_PERIOD_US;
+
+    // 新的移动指令：从当前位置和实测速度出发，按距离比例分配各轮限速，使所有轮子同时到达
+    // New move command: start from the current position and measured speed, share the speed limit in proportion to the distance so all wheels arrive together
+    if (cmd->move_id != move_active_id)
+    {
+        float peak = 0;
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            if (fabsf(cmd->move_distance[i]) > peak) peak = fabsf(cmd->move_distance[i]);
+        }
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            move_goal[i] = move_position[i] + cmd->move_distance[i];
+            move_speed[i] = read_speed[i];
+            move_scale[i] = (peak > 0) ? fabsf(cmd->move_distance[i]) / peak : 1.0f;
+            if (move_scale[i] < MOTOR_MOVE_MIN_SCALE) move_scale[i] = MOTOR_MOVE_MIN_SCALE;
+        }
+        move_active_id = cmd->move_id;
+        move_settle = 0;
+        move_notified = false;
+    }
+
+    bool on_target = true;
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        float v_max = cmd->move_speed * move_scale[i];
+        float a_max = cmd->move_accel * move_scale[i];
+        float error = move_goal[i] - move_position[i];
+        float dir = (error >= 0) ? 1.0f : -1.0f;
+
+        float v = fabsf(error) * MOTOR_MOVE_KP;
+        float v_stop = sqrtf(2.0f * a_max * fabsf(error));
+        if (v_stop < v) v = v_stop;
+        if (v_max < v) v = v_max;
+        v *= dir;
+
+        // 加速受最大加速度限制，减速直接跟随制动曲线
+        // Speeding up is limited by the max acceleration, slowing down follows the braking curve directly
+        float last = move_speed[i];
+        if (fabsf(v) > fabsf(last) || v * last < 0)
+        {
+            float step = a_max * dt;
+            if (v > last + step) v = last + step;
+            if (v < last - step) v = last - step;
+        }
+        move_speed[i] = Motor_Limit_Speed(v);
+
+        cmd->speed[i] = move_speed[i];
+        cmd->accel[i] = (move_speed[i] - last) / dt;
+        cmd->target[i] = move_speed[i] / (MOTOR_WHEEL_CIRCLE/MOTOR_ENCODER_CIRCLE/MOTOR_PID_PERIOD);
+
+        if (fabsf(error) > MOTOR_MOVE_POS_TOL || fabsf(read_speed[i]) > MOTOR_MOVE_VEL_TOL) on_target = false;
+    }
+
+    move_settle = on_target ? move_settle + 1 : 0;
+    if (move_settle >= settle_ticks && !move_notified)
+    {
+        move_notified = true;
+        atomic_store_explicit(&move_done_id, cmd->move_id, memory_order_release);
+        if (cmd->move_task != NULL) xTaskNotify(cmd->move_task, cmd->move_bits, eSetBits);
+    }
+}
+
 // PID算法控制电机速度
 // PID algorithm controls motor speed
 static void Motor_PID_Ctrl(void)
@@ -58,20 +523,300 @@ static void Motor_PID_Ctrl(void)
     static int cur_count[MOTOR_MAX_NUM] = {0};
     static float real_pulse[MOTOR_MAX_NUM] = {0};
     static float new_speed[MOTOR_MAX_NUM] = {0};
+    static float ff[MOTOR_MAX_NUM] = {0};
+    static bool last_enable = false;
+    static bool last_brake = false;
+    static motor_cmd_t cmd = {0};
+    static motor_speed_snapshot_t snapshot = {0};
+
+    // 一次取出完整的四轮命令
+    // Take the complete four-wheel command at once
+    Motor_Seqlock_Read(&cmd_seq, &cmd, cmd_mailbox, sizeof(cmd));
+    bool enable = cmd.enable;
+
+    // 停止命令只经邮箱发布，由本任务停止电机，本任务是PWM输出唯一的写方；停止方式变化时重新停止
+    // Stop commands are only published through the mailbox and this task stops the motors, so it is the only writer of the PWM outputs;
+    // the stop is issued again when the stop mode changes
+    if (!enable && (last_enable || cmd.brake != last_brake))
+    {
+        PwmMotor_Stop(MOTOR_ID_ALL, cmd.brake);
+    }
+    last_brake = cmd.brake;
+
+    // 重新使能时清除PID状态，避免停车前的积分带入下一次启动
+    // Reset the PID state when re-enabled, so the integral before the stop is not carried into the next start
+    if (enable && !last_enable)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            pid_reset_ctrl_block(pid_motor[i]);
+            new_pid_output[i] = 0;
+        }
+        if (pid_bank != NULL) pid_bank_reset(pid_bank);
+    }
+    last_enable = enable;
 
     for (int i = 0; i < MOTOR_MAX_NUM; i++)
     {
         cur_count[i] = Encoder_Get_Count(ENCODER_ID_M1 + i);
-        real_pulse[i] = cur_count[i] - last_count[i];
+        int pulse = cur_count[i] - last_count[i];
         last_count[i] = cur_count[i];
+
+        // 计数被清零时本周期没有有效测量，按预测值推进
+        // No valid measurement in this period when the count was cleared, advance with the prediction
+        if (pulse > MOTOR_PULSE_GATE || pulse < -MOTOR_PULSE_GATE)
+        {
+            observer[i].residual = 0;
+            pulse = (int)lroundf(observer[i].velocity);
+        }
+
+        // 观测器速度换算成参考周期脉冲数，同时用于读取速度和PID误差
+        // The observer velocity is converted to pulses per reference period, used for both the speed reading and the PID error
+        real_pulse[i] = Motor_Observer_Update(&observer[i], pulse) * MOTOR_CTRL_STEPS;
+        move_position[i] += pulse * (MOTOR_WHEEL_CIRCLE / MOTOR_ENCODER_CIRCLE / 1000.0f);
         read_speed[i] = real_pulse[i] * (MOTOR_WHEEL_CIRCLE/MOTOR_ENCODER_CIRCLE/MOTOR_PID_PERIOD);
-        if (pid_enable)
+        snapshot.speed[i] = read_speed[i];
+    }
+    uint8_t slip = Motor_Slip_Detect(&cmd, enable);
+    snapshot.slip_mask = slip;
+    snapshot.time_us = esp_timer_get_time();
+    Motor_Seqlock_Write(&speed_seq, speed_mailbox, &snapshot, sizeof(snapshot));
+    if (!enable) return;
+
+    if (cmd.move) Motor_Move_Ctrl(&cmd);
+
+    // 钩子修正本周期的设定速度，修正只作用于本地命令副本
+    // The hook corrects the setpoint speeds of this period, the correction only applies to the local command copy
+    motor_ctrl_hook_t hook = ctrl_hook;
+    if (hook != NULL)
+    {
+        hook(read_speed, cmd.speed, MOTOR_CTRL_PERIOD_US / 1000000.0f, ctrl_hook_arg);
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            cmd.speed[i] = Motor_Limit_Speed(cmd.speed[i]);
+            cmd.target[i] = cmd.speed[i] / (MOTOR_WHEEL_CIRCLE/MOTOR_ENCODER_CIRCLE/MOTOR_PID_PERIOD);
+        }
+    }
+    pwm_motor_decay_t decay = PwmMotor_Get_Decay();
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        ff[i] = Motor_FF_Output(&cmd, decay, i);
+    }
+
+    // 打滑的轮子限制PWM变化速度，在上一周期输出附近限幅，抗饱和按该范围工作
+    // Slipping wheels get a PWM ramp limit around the output of the last period, the anti-windup works on that range
+    float out_min[MOTOR_MAX_NUM], out_max[MOTOR_MAX_NUM];
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        out_min[i] = -PWM_MOTOR_MAX_VALUE;
+        out_max[i] = PWM_MOTOR_MAX_VALUE;
+        if (slip & (1 << i))
         {
-            pid_compute(pid_motor[i], pid_target[i] - real_pulse[i], &new_speed[i]);
-            PwmMotor_Set_Speed(MOTOR_ID_M1 + i, (int)new_speed[i]);
-            new_pid_output[i] = new_speed[i];
+            float ramp = MOTOR_SLIP_RAMP * PWM_MOTOR_EFFORT_SCALE * MOTOR_CTRL_PERIOD_US / 1000000.0f;
+            if (new_pid_output[i] - ramp > out_min[i]) out_min[i] = new_pid_output[i] - ramp;
+            if (new_pid_output[i] + ramp < out_max[i]) out_max[i] = new_pid_output[i] + ramp;
         }
     }
+
+    if (pid_use_bank)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            pid_bank_update_output_limit(pid_bank, i, out_min[i], out_max[i]);
+        }
+        // PID组一次计算四个轮子，输出已叠加前馈并按总输出限幅和抗饱和
+        // The PID bank computes the four wheels at once, the output already includes the feed-forward, limited and anti-windup on the total output
+        pid_bank_compute_2dof(pid_bank, cmd.target, real_pulse, ff, new_speed);
+    }
+    else
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            // PID输出叠加前馈输出，PID输出范围扣除前馈部分，抗饱和按实际输出饱和工作
+            // Add the feed-forward output to the PID output, the PID output range excludes the feed-forward part so the anti-windup sees the real saturation
+            pid_update_output_limit(pid_motor[i], out_min[i] - ff[i], out_max[i] - ff[i]);
+            pid_compute_2dof(pid_motor[i], cmd.target[i], real_pulse[i], &new_speed[i]);
+            new_speed[i] += ff[i];
+        }
+    }
+
+    int pwm[MOTOR_MAX_NUM];
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        float output = new_speed[i];
+        if (output > out_max[i]) output = out_max[i];
+        if (output < out_min[i]) output = out_min[i];
+        pwm[i] = (int)output;
+        new_pid_output[i] = output;
+    }
+    // 四个电机一次批量更新，转向不变时只写比较值
+    // The four motors are updated in one batch, only the compare values are written while the direction stays
+    uint32_t start = esp_cpu_get_cycle_count();
+    PwmMotor_Set_Speed_All(pwm[0], pwm[1], pwm[2], pwm[3]);
+    pwm_cycles = esp_cpu_get_cycle_count() - start;
+}
+
+// 统计一个控制周期的耗时，pwm为0表示本周期没有输出PWM(电机未使能)
+// Account the cost of one control period, pwm is 0 when the period wrote no PWM output (motors disabled)
+static void Motor_Cycles_Update(uint32_t ctrl, uint32_t pwm)
+{
+    static uint64_t ctrl_sum = 0;
+    static uint64_t pwm_sum = 0;
+    static uint32_t ctrl_n = 0;
+    static uint32_t pwm_n = 0;
+
+    ctrl_sum += ctrl;
+    ctrl_n++;
+    if (ctrl > atomic_load_explicit(&ctrl_cycles_max, memory_order_relaxed)) atomic_store_explicit(&ctrl_cycles_max, ctrl, memory_order_relaxed);
+    if (pwm > 0)
+    {
+        pwm_sum += pwm;
+        pwm_n++;
+        if (pwm > atomic_load_explicit(&pwm_cycles_max, memory_order_relaxed)) atomic_store_explicit(&pwm_cycles_max, pwm, memory_order_relaxed);
+    }
+    if (ctrl_n < MOTOR_CTRL_RATE_HZ) return;
+
+    atomic_store_explicit(&ctrl_cycles_avg, (unsigned int)(ctrl_sum / ctrl_n), memory_order_relaxed);
+    atomic_store_explicit(&pwm_cycles_avg, pwm_n > 0 ? (unsigned int)(pwm_sum / pwm_n) : 0, memory_order_relaxed);
+    ctrl_sum = 0;
+    pwm_sum = 0;
+    ctrl_n = 0;
+    pwm_n = 0;
+}
+
+// 运行一个控制周期并统计耗时
+// Run one control period and account its cost
+static void Motor_Ctrl_Period(void)
+{
+    pwm_cycles = 0;
+    uint32_t start = esp_cpu_get_cycle_count();
+    Motor_PID_Ctrl();
+    Motor_Cycles_Update(esp_cpu_get_cycle_count() - start, pwm_cycles);
+}
+
+// 读取控制周期耗时统计，单位：CPU周期
+// Read the control period cost statistics, unit: CPU cycles
+void Motor_Get_Ctrl_Cycles(motor_ctrl_cycles_t *cycles)
+{
+    cycles->ctrl_avg = atomic_load_explicit(&ctrl_cycles_avg, memory_order_relaxed);
+    cycles->ctrl_max = atomic_load_explicit(&ctrl_cycles_max, memory_order_relaxed);
+    cycles->pwm_avg = atomic_load_explicit(&pwm_cycles_avg, memory_order_relaxed);
+    cycles->pwm_max = atomic_load_explicit(&pwm_cycles_max, memory_order_relaxed);
+}
+
+// 清除控制周期耗时的最大值
+// Clear the maxima of the control period cost
+void Motor_Reset_Ctrl_Cycles(void)
+{
+    atomic_store_explicit(&ctrl_cycles_max, 0, memory_order_relaxed);
+    atomic_store_explicit(&pwm_cycles_max, 0, memory_order_relaxed);
+}
+
+// 比较四个独立PID控制块和PID组每个控制周期消耗的CPU周期数，各跑MOTOR_PID_BENCHMARK_ROUNDS轮取最小值，
+// 使用临时控制器，不影响电机状态。PID组更快时返回true
+// Compare the CPU cycles per control period of four separate PID control blocks and the PID bank, the minimum over
+// MOTOR_PID_BENCHMARK_ROUNDS rounds each, uses temporary controllers and leaves the motors untouched. Returns true when the bank is faster
+static bool Motor_PID_Benchmark(void)
+{
+    pid_ctrl_block_handle_t block[MOTOR_MAX_NUM] = {0};
+    pid_bank_handle_t bank = NULL;
+    pid_ctrl_config_t block_config = {
+        .init_param = pid_runtime_param,
+    };
+    pid_bank_config_t bank_config = {
+        .size = MOTOR_MAX_NUM,
+        .init_param = pid_runtime_param,
+    };
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        ESP_ERROR_CHECK(pid_new_control_block(&block_config, &block[i]));
+    }
+    ESP_ERROR_CHECK(pid_new_bank(&bank_config, &bank));
+
+    float setpoint[MOTOR_MAX_NUM] = {50, 52, 48, 51};
+    float measurement[MOTOR_MAX_NUM] = {0};
+    float ff[MOTOR_MAX_NUM] = {20, 21, 19, 20};
+    float output[MOTOR_MAX_NUM] = {0};
+    uint32_t block_cycles = UINT32_MAX;
+    uint32_t bank_cycles = UINT32_MAX;
+
+    for (int r = 0; r < MOTOR_PID_BENCHMARK_ROUNDS; r++)
+    {
+        uint32_t start = esp_cpu_get_cycle_count();
+        for (int k = 0; k < MOTOR_PID_BENCHMARK_LOOPS; k++)
+        {
+            for (int i = 0; i < MOTOR_MAX_NUM; i++)
+            {
+                measurement[i] = (k & 0x3F) + i;
+                pid_update_output_limit(block[i], -PWM_MOTOR_MAX_VALUE - ff[i], PWM_MOTOR_MAX_VALUE - ff[i]);
+                pid_compute_2dof(block[i], setpoint[i], measurement[i], &output[i]);
+                output[i] += ff[i];
+            }
+        }
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        if (cycles < block_cycles) block_cycles = cycles;
+
+        start = esp_cpu_get_cycle_count();
+        for (int k = 0; k < MOTOR_PID_BENCHMARK_LOOPS; k++)
+        {
+            for (int i = 0; i < MOTOR_MAX_NUM; i++)
+            {
+                measurement[i] = (k & 0x3F) + i;
+                pid_bank_update_output_limit(bank, i, -PWM_MOTOR_MAX_VALUE, PWM_MOTOR_MAX_VALUE);
+            }
+            pid_bank_compute_2dof(bank, setpoint, measurement, ff, output);
+        }
+        cycles = esp_cpu_get_cycle_count() - start;
+        if (cycles < bank_cycles) bank_cycles = cycles;
+    }
+
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        pid_del_control_block(block[i]);
+    }
+    pid_del_bank(bank);
+
+    block_cycles /= MOTOR_PID_BENCHMARK_LOOPS;
+    bank_cycles /= MOTOR_PID_BENCHMARK_LOOPS;
+    bool use_bank = bank_cycles < block_cycles;
+    ESP_LOGI(TAG, "PID cycles per tick, blocks:%u bank:%u, using %s", (unsigned int)block_cycles, (unsigned int)bank_cycles,
+             use_bank ? "bank" : "blocks");
+    return use_bank;
+}
+
+// 控制定时器中断回调，唤醒控制循环任务
+// Control timer interrupt callback, wakes the control loop task
+static bool Motor_Timer_Callback(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx)
+{
+    BaseType_t task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(motor_task_handle, &task_woken);
+    return task_woken == pdTRUE;
+}
+
+// 初始化控制定时器，在控制循环任务所在的核心上注册中断
+// Initialize the control timer, the interrupt is registered on the core of the control loop task
+static void Motor_Timer_Init(void)
+{
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &ctrl_timer));
+
+    gptimer_event_callbacks_t cbs = {
+        .on_alarm = Motor_Timer_Callback,
+    };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(ctrl_timer, &cbs, NULL));
+
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = MOTOR_CTRL_PERIOD_US,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ESP_ERROR_CHECK(gptimer_set_alarm_action(ctrl_timer, &alarm_config));
+    ESP_ERROR_CHECK(gptimer_enable(ctrl_timer));
+    ESP_ERROR_CHECK(gptimer_start(ctrl_timer));
 }
 
 
@@ -81,29 +826,69 @@ static void Motor_Task(void *arg)
     pid_runtime_param.kp = 1.0;
     pid_runtime_param.ki = 0.2;
     pid_runtime_param.kd = 0.2;
-    pid_runtime_param.cal_type = PID_CAL_TYPE_INCREMENTAL;
+    pid_runtime_param.cal_type = MOTOR_PID_CAL_TYPE;
     pid_runtime_param.max_output   = PWM_MOTOR_MAX_VALUE;
     pid_runtime_param.min_output   = -PWM_MOTOR_MAX_VALUE;
     pid_runtime_param.max_integral = 1000;
     pid_runtime_param.min_integral = -1000;
+    pid_runtime_param.beta = MOTOR_PID_BETA;
+    pid_runtime_param.gamma = MOTOR_PID_GAMMA;
+    pid_runtime_param.d_filter = MOTOR_CTRL_PERIOD_US / (MOTOR_CTRL_PERIOD_US + MOTOR_PID_D_FILTER_MS * 1000.0f);
+    pid_runtime_param.kb = MOTOR_CTRL_PERIOD_US / (MOTOR_PID_TRACK_MS * 1000.0f);
+    if (pid_runtime_param.kb > 1) pid_runtime_param.kb = 1;
+
+    // 每个轮子先使用默认参数，NVS中有整定结果时覆盖
+    // Each wheel starts with the default parameters, overridden by the tuned ones in NVS
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        pid_wheel_param[i] = pid_runtime_param;
+    }
+    if (Motor_Load_PID() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Motor PID not tuned, use default parameters");
+    }
     
-    pid_ctrl_config_t pid_config = {
-        .init_param = pid_runtime_param,
-    };
     for (int i = 0; i < MOTOR_MAX_NUM; i++)
     {
+        pid_ctrl_config_t pid_config = {
+            .init_param = pid_wheel_param[i],
+        };
         ESP_ERROR_CHECK(pid_new_control_block(&pid_config, &pid_motor[i]));
     }
+    if (MOTOR_PID_CAL_TYPE == PID_CAL_TYPE_2DOF)
+    {
+        pid_bank_config_t bank_config = {
+            .size = MOTOR_MAX_NUM,
+            .init_param = pid_runtime_param,
+        };
+        ESP_ERROR_CHECK(pid_new_bank(&bank_config, &pid_bank));
+        pid_use_bank = Motor_PID_Benchmark();
+    }
+    Motor_Apply_PID_Parm();
+    Motor_Observer_Init();
+    Motor_Slip_Init();
     
     vTaskDelay(pdMS_TO_TICKS(100));
+#if MOTOR_CTRL_USE_TIMER
+    ESP_LOGI(TAG, "Motor control rate: %d Hz (gptimer)", MOTOR_CTRL_RATE_HZ);
+    motor_task_handle = xTaskGetCurrentTaskHandle();
+    Motor_Timer_Init();
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        Motor_Ctrl_Period();
+    }
+#else
+    ESP_LOGI(TAG, "Motor control rate: %d Hz (tick)", MOTOR_CTRL_RATE_HZ);
     TickType_t lastWakeTime = xTaskGetTickCount();
     while (1)
     {
-        Motor_PID_Ctrl();
-        vTaskDelayUntil(&lastWakeTime, MOTOR_PID_PERIOD);
+        Motor_Ctrl_Period();
+        vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(MOTOR_CTRL_PERIOD_US / 1000));
     }
+#endif
 
-    Motor_Stop(STOP_BRAKE);
+    PwmMotor_Stop(MOTOR_ID_ALL, STOP_BRAKE);
     vTaskDelete(NULL);
 }
 
@@ -112,56 +897,130 @@ static void Motor_Task(void *arg)
 void Motor_Set_Speed(float speed_m1, float speed_m2, float speed_m3, float speed_m4)
 {
     static float speed_m[MOTOR_MAX_NUM] = {0};
+    static float last_speed[MOTOR_MAX_NUM] = {0};
+    static int64_t last_time = 0;
+    motor_cmd_t cmd = {0};
     speed_m[0] = Motor_Limit_Speed(speed_m1);
     speed_m[1] = Motor_Limit_Speed(speed_m2);
     speed_m[2] = Motor_Limit_Speed(speed_m3);
     speed_m[3] = Motor_Limit_Speed(speed_m4);
 
+    int64_t now = esp_timer_get_time();
+    float dt = (now - last_time) / 1000000.0f;
+    last_time = now;
+    if (dt < MOTOR_PID_PERIOD / 1000.0f) dt = MOTOR_PID_PERIOD / 1000.0f;
+
     for (int i = 0; i < MOTOR_MAX_NUM; i++)
     {
-        // 速度转化成10毫秒编码器目标数量
-        // The speed is converted to the number of encoder targets in 10 milliseconds
-        speed_count[i] = speed_m[i] / (MOTOR_WHEEL_CIRCLE/MOTOR_ENCODER_CIRCLE/MOTOR_PID_PERIOD);
-        pid_target[i] = (float)speed_count[i];
+        // 前馈加速度取相邻两次设定速度的差分
+        // The feed-forward acceleration is the difference of two consecutive speed settings
+        float accel = (dt > MOTOR_FF_ACCEL_DT_MAX) ? 0 : (speed_m[i] - last_speed[i]) / dt;
+        if (accel > MOTOR_FF_ACCEL_MAX) accel = MOTOR_FF_ACCEL_MAX;
+        if (accel < -MOTOR_FF_ACCEL_MAX) accel = -MOTOR_FF_ACCEL_MAX;
+        cmd.accel[i] = accel;
+        cmd.speed[i] = speed_m[i];
+        last_speed[i] = speed_m[i];
+
+        // 速度转化成参考周期(10毫秒)编码器目标数量，与控制频率无关
+        // The speed is converted to the number of encoder targets per reference period (10 ms), independent of the control rate
+        cmd.target[i] = speed_m[i] / (MOTOR_WHEEL_CIRCLE/MOTOR_ENCODER_CIRCLE/MOTOR_PID_PERIOD);
     }
-    pid_enable = 1;
+    cmd.enable = true;
+    cmd.time_us = now;
+    Motor_Seqlock_Write(&cmd_seq, cmd_mailbox, &cmd, sizeof(cmd));
 }
 
 // 读取当前电机速度值
 // Read the current motor speed value
 void Motor_Get_Speed(float* speed_m1, float* speed_m2, float* speed_m3, float* speed_m4)
 {
-    *speed_m1 = read_speed[0];
-    *speed_m2 = read_speed[1];
-    *speed_m3 = read_speed[2];
-    *speed_m4 = read_speed[3];
+    motor_speed_snapshot_t snapshot;
+    Motor_Get_Speed_Snapshot(&snapshot);
+    *speed_m1 = snapshot.speed[0];
+    *speed_m2 = snapshot.speed[1];
+    *speed_m3 = snapshot.speed[2];
+    *speed_m4 = snapshot.speed[3];
 }
 
+// 读取同一个控制周期的四轮速度和测量时间
+// Read the four wheel speeds of the same control period and the measurement time
+void Motor_Get_Speed_Snapshot(motor_speed_snapshot_t *snapshot)
+{
+    Motor_Seqlock_Read(&speed_seq, snapshot, speed_mailbox, sizeof(*snapshot));
+}
+
+
+// 取出并清除上次读取以来出现过打滑的轮子掩码，bit0~3对应M1~M4
+// Take and clear the mask of the wheels that slipped since the last call, bit0~3 for M1~M4
+uint8_t Motor_Take_Slip_Mask(void)
+{
+    return (uint8_t)atomic_exchange_explicit(&slip_events, 0, memory_order_relaxed);
+}
 
-// 电机停止，brake=true表示刹车停止，brake=false表示滑行停止。
+// 电机停止，brake=true表示刹车停止，brake=false表示滑行停止。停止命令经邮箱发给Motor_Task，在下一个控制周期生效
 // The motor stops. brake=true indicates that the brake stops, and brake=false indicates that the coasting stops.
+// The stop command is posted to Motor_Task through the mailbox and takes effect in the next control period
 void Motor_Stop(bool brake)
 {
-    Motor_Set_Speed(0, 0, 0, 0);
-    pid_enable = 0;
-    PwmMotor_Stop(MOTOR_ID_ALL, brake);
+    motor_cmd_t cmd = {
+        .enable = false,
+        .brake = brake,
+        .time_us = esp_timer_get_time(),
+    };
+    Motor_Seqlock_Write(&cmd_seq, cmd_mailbox, &cmd, sizeof(cmd));
+}
+
+// 四个轮子分别移动distance(m)，限速max_speed(m/s)，限加速度max_accel(m/s^2，<=0使用默认值)，位置环在Motor_Task中运行，
+// 到位后向task发送notify_bits通知(task=NULL时不通知)，并保持在目标位置直到下一条指令
+// Move the four wheels by distance (m) each, with max_speed (m/s) and max_accel (m/s^2, <=0 for the default); the position loop runs in Motor_Task,
+// notify_bits are sent to task on arrival (no notification when task=NULL) and the position is held until the next command
+void Motor_Move_Distance(const float *distance, float max_speed, float max_accel, TaskHandle_t task, uint32_t notify_bits)
+{
+    motor_cmd_t cmd = {
+        .enable = true,
+        .move = true,
+        .move_id = ++move_id,
+        .move_speed = Motor_Limit_Speed(fabsf(max_speed)),
+        .move_accel = (max_accel > 0) ? max_accel : MOTOR_FF_ACCEL_MAX,
+        .move_task = task,
+        .move_bits = notify_bits,
+        .time_us = esp_timer_get_time(),
+    };
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        cmd.move_distance[i] = distance[i];
+    }
+    Motor_Seqlock_Write(&cmd_seq, cmd_mailbox, &cmd, sizeof(cmd));
+}
+
+// 最近一次Motor_Move_Distance是否已经到位
+// Whether the last Motor_Move_Distance has arrived
+bool Motor_Move_Done(void)
+{
+    return atomic_load_explicit(&move_done_id, memory_order_acquire) == move_id;
+}
+
+// 设置控制周期钩子，hook=NULL时取消，钩子在Motor_Task中运行，不能阻塞
+// Set the control period hook, NULL to remove it, the hook runs in Motor_Task and must not block
+void Motor_Set_Ctrl_Hook(motor_ctrl_hook_t hook, void *arg)
+{
+    ctrl_hook = NULL;
+    ctrl_hook_arg = arg;
+    ctrl_hook = hook;
 }
 
-// 更新电机PID参数
-// Update motor PID parameters
+// 更新电机PID参数，所有轮子使用同一组参数
+// Update motor PID parameters, all wheels use the same set
 void Motor_Update_PID_Parm(float pid_p, float pid_i, float pid_d)
 {
     pid_runtime_param.kp = pid_p;
     pid_runtime_param.ki = pid_i;
     pid_runtime_param.kd = pid_d;
-    for (int i = 0; i < MOTOR_MAX_NUM; i++)
-    {
-        pid_update_parameters(pid_motor[i], &pid_runtime_param);
-    }
+    Motor_Update_Wheel_PID_Parm(MOTOR_ID_ALL, pid_p, pid_i, pid_d);
 }
 
-// 读取电机PID参数
-// Read motor PID parameters
+// 读取电机PID参数(参考周期下的值)
+// Read motor PID parameters (values at the reference period)
 void Motor_Read_PID_Parm(float* out_p, float* out_i, float* out_d)
 {
     *out_p = pid_runtime_param.kp;
@@ -169,6 +1028,532 @@ void Motor_Read_PID_Parm(float* out_p, float* out_i, float* out_d)
     *out_d = pid_runtime_param.kd;
 }
 
+// 更新单个轮子的PID参数，motor_id=MOTOR_ID_ALL时设置全部电机
+// Update the PID parameters of one wheel, all motors when motor_id=MOTOR_ID_ALL
+void Motor_Update_Wheel_PID_Parm(motor_id_t motor_id, float pid_p, float pid_i, float pid_d)
+{
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        if (motor_id != MOTOR_ID_ALL && motor_id != MOTOR_ID_M1 + i) continue;
+        pid_wheel_param[i].kp = pid_p;
+        pid_wheel_param[i].ki = pid_i;
+        pid_wheel_param[i].kd = pid_d;
+    }
+    Motor_Apply_PID_Parm();
+}
+
+// 读取单个轮子的PID参数
+// Read the PID parameters of one wheel
+void Motor_Read_Wheel_PID_Parm(motor_id_t motor_id, float* out_p, float* out_i, float* out_d)
+{
+    int index = (motor_id == MOTOR_ID_ALL) ? 0 : motor_id - MOTOR_ID_M1;
+    *out_p = pid_wheel_param[index].kp;
+    *out_i = pid_wheel_param[index].ki;
+    *out_d = pid_wheel_param[index].kd;
+}
+
+// 从NVS读取每个轮子的PID参数
+// Load the PID parameters of each wheel from NVS
+esp_err_t Motor_Load_PID(void)
+{
+    nvs_handle_t handle;
+    motor_pid_blob_t blob = {0};
+    size_t size = sizeof(blob);
+
+    esp_err_t err = nvs_open(MOTOR_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_get_blob(handle, MOTOR_NVS_KEY_PID, &blob, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) return err;
+    if (size != sizeof(blob) || blob.version != MOTOR_PID_VERSION) return ESP_ERR_INVALID_VERSION;
+
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        pid_wheel_param[i].kp = blob.gain[i][0];
+        pid_wheel_param[i].ki = blob.gain[i][1];
+        pid_wheel_param[i].kd = blob.gain[i][2];
+        ESP_LOGI(TAG, "M%d PID kp:%.3f ki:%.3f kd:%.3f", i + 1, blob.gain[i][0], blob.gain[i][1], blob.gain[i][2]);
+    }
+    return ESP_OK;
+}
+
+// 保存每个轮子的PID参数到NVS
+// Save the PID parameters of each wheel to NVS
+esp_err_t Motor_Save_PID(void)
+{
+    nvs_handle_t handle;
+    motor_pid_blob_t blob = {
+        .version = MOTOR_PID_VERSION,
+    };
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        blob.gain[i][0] = pid_wheel_param[i].kp;
+        blob.gain[i][1] = pid_wheel_param[i].ki;
+        blob.gain[i][2] = pid_wheel_param[i].kd;
+    }
+
+    esp_err_t err = nvs_open(MOTOR_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, MOTOR_NVS_KEY_PID, &blob, sizeof(blob));
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+// PID继电器自整定，车轮需悬空。四个轮子各自在工作点速度附近做继电器振荡，
+// 由振荡幅值a和周期Tu得到临界增益Ku=4d/(pi*sqrt(a^2-eps^2))，再按Tyreus-Luyben规则计算PID参数，
+// 换算成参考周期下的增量式参数后保存到NVS。
+// PID relay auto-tune, the wheels must be lifted. Each wheel runs a relay oscillation around the operating speed,
+// the amplitude a and period Tu give the ultimate gain Ku=4d/(pi*sqrt(a^2-eps^2)), the PID parameters follow the Tyreus-Luyben rule,
+// converted to incremental parameters at the reference period and saved to NVS.
+esp_err_t Motor_Auto_Tune_PID(void)
+{
+    float target = MOTOR_TUNE_SPEED / (MOTOR_WHEEL_CIRCLE/MOTOR_ENCODER_CIRCLE/MOTOR_PID_PERIOD);
+    float bias[MOTOR_MAX_NUM] = {0};
+    bool high[MOTOR_MAX_NUM] = {0};
+    int64_t last_rise[MOTOR_MAX_NUM] = {0};
+    int64_t period_sum[MOTOR_MAX_NUM] = {0};
+    int period_n[MOTOR_MAX_NUM] = {0};
+    float pulse_max[MOTOR_MAX_NUM] = {0};
+    float pulse_min[MOTOR_MAX_NUM] = {0};
+
+    ESP_LOGI(TAG, "Start PID auto-tune");
+    Motor_Stop(STOP_COAST);
+    vTaskDelay(pdMS_TO_TICKS(MOTOR_FF_CAL_REST_MS));
+
+    // 继电器偏置取当前衰减方式下前馈在工作点的输出，未标定前馈时使用默认偏置
+    // The relay bias is the feed-forward output at the operating point in the current decay mode, the default bias when the feed-forward is not calibrated
+    const motor_ff_t *ff = motor_ff[PwmMotor_Get_Decay()];
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        bias[i] = (ff[i].kv > 0) ? ff[i].ks + ff[i].kv * MOTOR_TUNE_SPEED : MOTOR_TUNE_BIAS * PWM_MOTOR_EFFORT_SCALE;
+        last_rise[i] = -1;
+        pulse_max[i] = -1e6f;
+        pulse_min[i] = 1e6f;
+    }
+
+    // 继电器切换时刻用esp_timer打点，周期和跳过窗口都按实际经过的时间计算，不受任务延时和调度抖动影响
+    // The relay switches are timestamped with esp_timer, the period and the skip window use the real elapsed time, unaffected by task delay and scheduling jitter
+    int64_t start = esp_timer_get_time();
+    TickType_t wake = xTaskGetTickCount();
+    for (;;)
+    {
+        motor_speed_snapshot_t snapshot;
+        Motor_Get_Speed_Snapshot(&snapshot);
+        int64_t t = esp_timer_get_time() - start;
+        if (t >= MOTOR_TUNE_MS * 1000LL) break;
+        bool settled = t >= MOTOR_TUNE_SKIP_MS * 1000LL;
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            float pulse = snapshot.speed[i] / (MOTOR_WHEEL_CIRCLE/MOTOR_ENCODER_CIRCLE/MOTOR_PID_PERIOD);
+            float error = target - pulse;
+            if (!high[i] && error > MOTOR_TUNE_HYSTERESIS)
+            {
+                high[i] = true;
+                if (settled && last_rise[i] >= 0)
+                {
+                    period_sum[i] += t - last_rise[i];
+                    period_n[i]++;
+                }
+                last_rise[i] = t;
+            }
+            else if (high[i] && error < -MOTOR_TUNE_HYSTERESIS)
+            {
+                high[i] = false;
+            }
+            if (settled)
+            {
+                if (pulse > pulse_max[i]) pulse_max[i] = pulse;
+                if (pulse < pulse_min[i]) pulse_min[i] = pulse;
+            }
+            float u = bias[i] + (high[i] ? MOTOR_TUNE_RELAY : -MOTOR_TUNE_RELAY) * PWM_MOTOR_EFFORT_SCALE;
+            PwmMotor_Set_Speed(MOTOR_ID_M1 + i, (int)u);
+        }
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(MOTOR_TUNE_SAMPLE_MS));
+    }
+    PwmMotor_Stop(MOTOR_ID_ALL, STOP_COAST);
+
+    float gain[MOTOR_MAX_NUM][3] = {0};
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        float a = (pulse_max[i] - pulse_min[i]) / 2;
+        if (period_n[i] < MOTOR_TUNE_MIN_CYCLES || a <= MOTOR_TUNE_HYSTERESIS)
+        {
+            ESP_LOGW(TAG, "M%d PID auto-tune failed, cycles:%d amplitude:%.2f", i + 1, period_n[i], a);
+            return ESP_FAIL;
+        }
+        float ku = 4 * MOTOR_TUNE_RELAY / ((float)M_PI * sqrtf(a * a - MOTOR_TUNE_HYSTERESIS * MOTOR_TUNE_HYSTERESIS));
+        float tu = (float)period_sum[i] / period_n[i] / 1000.0f;
+
+        // Tyreus-Luyben: Kp=Ku/2.2, Ti=2.2Tu, Td=Tu/6.3；增量式 ki=Kp*T0/Ti, kd=Kp*Td/T0
+        // Tyreus-Luyben: Kp=Ku/2.2, Ti=2.2Tu, Td=Tu/6.3; incremental ki=Kp*T0/Ti, kd=Kp*Td/T0
+        float kp = ku / 2.2f;
+        gain[i][0] = kp;
+        gain[i][1] = kp * MOTOR_PID_PERIOD / (2.2f * tu);
+        gain[i][2] = kp * (tu / 6.3f) / MOTOR_PID_PERIOD;
+        ESP_LOGI(TAG, "M%d Ku:%.3f Tu:%.0fms -> kp:%.3f ki:%.3f kd:%.3f", i + 1, ku, tu, gain[i][0], gain[i][1], gain[i][2]);
+    }
+
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        Motor_Update_Wheel_PID_Parm(MOTOR_ID_M1 + i, gain[i][0], gain[i][1], gain[i][2]);
+    }
+    return Motor_Save_PID();
+}
+
+// 设置一种衰减方式下的电机前馈参数，motor_id=MOTOR_ID_ALL时设置全部电机
+// Set the motor feed-forward parameters of one decay mode, all motors when motor_id=MOTOR_ID_ALL
+void Motor_Set_FF(pwm_motor_decay_t decay, motor_id_t motor_id, const motor_ff_t *ff)
+{
+    if (decay >= PWM_MOTOR_DECAY_MAX) return;
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        if (motor_id == MOTOR_ID_ALL || motor_id == MOTOR_ID_M1 + i) motor_ff[decay][i] = *ff;
+    }
+}
+
+// 读取一种衰减方式下的电机前馈参数
+// Read the motor feed-forward parameters of one decay mode
+void Motor_Get_FF(pwm_motor_decay_t decay, motor_id_t motor_id, motor_ff_t *ff)
+{
+    if (decay >= PWM_MOTOR_DECAY_MAX) return;
+    int index = (motor_id == MOTOR_ID_ALL) ? 0 : motor_id - MOTOR_ID_M1;
+    *ff = motor_ff[decay][index];
+}
+
+// 从NVS读取前馈参数，PWM分辨率变化时按比例换算
+// Load the feed-forward parameters from NVS, rescaled when the PWM resolution has changed
+esp_err_t Motor_Load_FF(void)
+{
+    nvs_handle_t handle;
+    motor_ff_blob_t blob = {0};
+    size_t size = sizeof(blob);
+
+    esp_err_t err = nvs_open(MOTOR_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_get_blob(handle, MOTOR_NVS_KEY_FF, &blob, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) return err;
+    if (size != sizeof(blob) || blob.version != MOTOR_FF_VERSION || blob.duty_max <= 0) return ESP_ERR_INVALID_VERSION;
+
+    float scale = (float)PWM_MOTOR_DUTY_TICK_MAX / blob.duty_max;
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            motor_ff_t *ff = &motor_ff[m][i];
+            ff->ks = blob.ff[m][i].ks * scale;
+            ff->kv = blob.ff[m][i].kv * scale;
+            ff->ka = blob.ff[m][i].ka * scale;
+            ESP_LOGI(TAG, "M%d decay %d FF ks:%.1f kv:%.1f ka:%.1f", i + 1, m, ff->ks, ff->kv, ff->ka);
+        }
+    }
+    return ESP_OK;
+}
+
+// 保存前馈参数到NVS
+// Save the feed-forward parameters to NVS
+esp_err_t Motor_Save_FF(void)
+{
+    nvs_handle_t handle;
+    motor_ff_blob_t blob = {
+        .version = MOTOR_FF_VERSION,
+        .duty_max = PWM_MOTOR_DUTY_TICK_MAX,
+    };
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            blob.ff[m][i] = motor_ff[m][i];
+        }
+    }
+
+    esp_err_t err = nvs_open(MOTOR_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, MOTOR_NVS_KEY_FF, &blob, sizeof(blob));
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+// 在一种衰减方式下标定前馈参数。每个轮子按正反方向施加若干开环PWM阶跃：
+// 稳态速度与PWM做最小二乘拟合得到ks和kv；由阶跃响应面积得到时间常数tau，ka=kv*tau。
+// 观测器对阶跃的跟踪误差积分为零，不影响tau的测量。
+// Calibrate the feed-forward parameters of one decay mode. Several open-loop PWM steps are applied to each wheel in both directions:
+// a least-squares fit of the steady-state speed against PWM gives ks and kv; the step response area gives the time constant tau, ka=kv*tau.
+// The integrated tracking error of the observer to a step is zero, so it does not bias tau.
+static esp_err_t Motor_Calibrate_FF_Mode(pwm_motor_decay_t decay)
+{
+    float sum_v[MOTOR_MAX_NUM] = {0};
+    float sum_u[MOTOR_MAX_NUM] = {0};
+    float sum_vv[MOTOR_MAX_NUM] = {0};
+    float sum_vu[MOTOR_MAX_NUM] = {0};
+    float sum_tau[MOTOR_MAX_NUM] = {0};
+    int n = 0;
+
+    PwmMotor_Set_Decay(decay);
+    for (int dir = 1; dir >= -1; dir -= 2)
+    {
+        for (int s = 0; s < MOTOR_FF_CAL_STEP_NUM; s++)
+        {
+            int u = (int)(dir * ff_cal_level[s] * PWM_MOTOR_EFFORT_SCALE);
+            float area[MOTOR_MAX_NUM] = {0};
+            float steady[MOTOR_MAX_NUM] = {0};
+            int steady_n = 0;
+
+            PwmMotor_Set_Speed_All(u, u, u, u);
+            for (int t = 0; t < MOTOR_FF_CAL_STEP_MS; t += MOTOR_FF_CAL_SAMPLE_MS)
+            {
+                vTaskDelay(pdMS_TO_TICKS(MOTOR_FF_CAL_SAMPLE_MS));
+                motor_speed_snapshot_t snapshot;
+                Motor_Get_Speed_Snapshot(&snapshot);
+                for (int i = 0; i < MOTOR_MAX_NUM; i++)
+                {
+                    area[i] += snapshot.speed[i] * (MOTOR_FF_CAL_SAMPLE_MS / 1000.0f);
+                    if (t >= MOTOR_FF_CAL_STEP_MS - MOTOR_FF_CAL_AVG_MS) steady[i] += snapshot.speed[i];
+                }
+                if (t >= MOTOR_FF_CAL_STEP_MS - MOTOR_FF_CAL_AVG_MS) steady_n++;
+            }
+            PwmMotor_Stop(MOTOR_ID_ALL, STOP_COAST);
+
+            for (int i = 0; i < MOTOR_MAX_NUM; i++)
+            {
+                float v = fabsf(steady[i] / steady_n);
+                float a = fabsf(area[i]);
+                sum_v[i] += v;
+                sum_u[i] += abs(u);
+                sum_vv[i] += v * v;
+                sum_vu[i] += v * abs(u);
+                if (v > 0) sum_tau[i] += MOTOR_FF_CAL_STEP_MS / 1000.0f - a / v;
+            }
+            n++;
+            vTaskDelay(pdMS_TO_TICKS(MOTOR_FF_CAL_REST_MS));
+        }
+    }
+
+    motor_ff_t result[MOTOR_MAX_NUM] = {0};
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        float den = n * sum_vv[i] - sum_v[i] * sum_v[i];
+        if (den <= 0)
+        {
+            ESP_LOGW(TAG, "M%d decay %d feed-forward calibration failed, no speed measured", i + 1, decay);
+            return ESP_FAIL;
+        }
+        result[i].kv = (n * sum_vu[i] - sum_v[i] * sum_u[i]) / den;
+        result[i].ks = (sum_u[i] - result[i].kv * sum_v[i]) / n;
+        if (result[i].kv <= 0)
+        {
+            ESP_LOGW(TAG, "M%d decay %d feed-forward calibration failed, kv:%.1f", i + 1, decay, result[i].kv);
+            return ESP_FAIL;
+        }
+        if (result[i].ks < 0) result[i].ks = 0;
+        float tau = sum_tau[i] / n;
+        result[i].ka = (tau > 0) ? result[i].kv * tau : 0;
+        ESP_LOGI(TAG, "M%d decay %d FF ks:%.1f kv:%.1f ka:%.1f tau:%.3f", i + 1, decay, result[i].ks, result[i].kv, result[i].ka, tau);
+    }
+
+    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+    {
+        Motor_Set_FF(decay, MOTOR_ID_M1 + i, &result[i]);
+    }
+    return ESP_OK;
+}
+
+// 前馈参数标定，车轮需悬空。每种衰减方式各标定一套，结束后恢复原来的衰减方式
+// Feed-forward calibration, the wheels must be lifted. One set is calibrated for each decay mode, the previous decay mode is restored afterwards
+esp_err_t Motor_Calibrate_FF(void)
+{
+    pwm_motor_decay_t decay = PwmMotor_Get_Decay();
+    esp_err_t err = ESP_OK;
+
+    ESP_LOGI(TAG, "Start feed-forward calibration");
+    Motor_Stop(STOP_COAST);
+    vTaskDelay(pdMS_TO_TICKS(MOTOR_FF_CAL_REST_MS));
+
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX && err == ESP_OK; m++)
+    {
+        err = Motor_Calibrate_FF_Mode(m);
+    }
+    PwmMotor_Set_Decay(decay);
+    if (err != ESP_OK) return err;
+    return Motor_Save_FF();
+}
+
+// 从NVS读取PWM线性化表，PWM分辨率变化时按比例换算
+// Load the PWM linearization tables from NVS, rescaled when the PWM resolution has changed
+esp_err_t Motor_Load_Lut(void)
+{
+    nvs_handle_t handle;
+    motor_lut_blob_t blob = {0};
+    size_t size = sizeof(blob);
+
+    esp_err_t err = nvs_open(MOTOR_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_get_blob(handle, MOTOR_NVS_KEY_LUT, &blob, &size);
+    nvs_close(handle);
+    if (err != ESP_OK) return err;
+    if (size != sizeof(blob) || blob.version != MOTOR_LUT_VERSION || blob.duty_max <= 0) return ESP_ERR_INVALID_VERSION;
+
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            for (int dir = 0; dir < PWM_MOTOR_DIR_MAX; dir++)
+            {
+                uint16_t duty[PWM_MOTOR_LUT_SIZE];
+                for (int k = 0; k < PWM_MOTOR_LUT_SIZE; k++)
+                {
+                    duty[k] = (uint16_t)((uint32_t)blob.lut[m][i][dir][k] * PWM_MOTOR_DUTY_TICK_MAX / blob.duty_max);
+                }
+                PwmMotor_Set_Lut(m, MOTOR_ID_M1 + i, dir, duty);
+            }
+            ESP_LOGI(TAG, "M%d decay %d LUT breakaway fwd:%d rev:%d", i + 1, m, blob.lut[m][i][0][0], blob.lut[m][i][1][0]);
+        }
+    }
+    return ESP_OK;
+}
+
+// 保存PWM线性化表到NVS
+// Save the PWM linearization tables to NVS
+esp_err_t Motor_Save_Lut(void)
+{
+    nvs_handle_t handle;
+    motor_lut_blob_t blob = {
+        .version = MOTOR_LUT_VERSION,
+        .duty_max = PWM_MOTOR_DUTY_TICK_MAX,
+    };
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            for (int dir = 0; dir < PWM_MOTOR_DIR_MAX; dir++)
+            {
+                PwmMotor_Get_Lut(m, MOTOR_ID_M1 + i, dir, blob.lut[m][i][dir]);
+            }
+        }
+    }
+
+    esp_err_t err = nvs_open(MOTOR_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(handle, MOTOR_NVS_KEY_LUT, &blob, sizeof(blob));
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+// 在单调的duty-速度曲线上反查达到speed需要的duty
+// Look up the duty that reaches speed on the monotonic duty-speed curve
+static float Motor_Lut_Inverse(const float *curve, float speed)
+{
+    const float step = (float)PWM_MOTOR_DUTY_TICK_MAX / (MOTOR_LUT_CAL_LEVELS - 1);
+    for (int j = 1; j < MOTOR_LUT_CAL_LEVELS; j++)
+    {
+        if (curve[j] < speed) continue;
+        float span = curve[j] - curve[j - 1];
+        if (span <= 0) return j * step;
+        return (j - 1 + (speed - curve[j - 1]) / span) * step;
+    }
+    return PWM_MOTOR_DUTY_TICK_MAX;
+}
+
+// PWM线性化表标定，车轮需悬空。每种衰减方式、每个方向把开环duty从0逐级扫到最大值，记录每个轮子的稳态速度：
+// 第0点取起转duty，其余各点取速度与出力成正比所需的duty，满出力对应所有衰减方式、四个轮子两个方向中最低的最高速度，
+// 标定后不论衰减方式，所有轮子对同一出力的速度相同。线性化表变化后前馈参数需要重新标定
+// PWM linearization calibration, the wheels must be lifted. In each decay mode and direction the open-loop duty is swept level by level
+// from 0 to the maximum, recording the steady-state speed of every wheel: point 0 is the breakaway duty, the other points are the duty
+// that makes the speed proportional to the effort, full effort being the lowest top speed over all decay modes, the four wheels and both
+// directions, so after calibration every wheel runs at the same speed for the same effort whatever the decay mode.
+// The feed-forward needs recalibrating after the table changes
+esp_err_t Motor_Calibrate_Lut(void)
+{
+    static float curve[PWM_MOTOR_DECAY_MAX][MOTOR_MAX_NUM][PWM_MOTOR_DIR_MAX][MOTOR_LUT_CAL_LEVELS];
+    const int samples = MOTOR_LUT_CAL_AVG_MS / MOTOR_LUT_CAL_SAMPLE_MS;
+    pwm_motor_decay_t decay = PwmMotor_Get_Decay();
+
+    ESP_LOGI(TAG, "Start PWM linearization calibration");
+    Motor_Stop(STOP_COAST);
+    vTaskDelay(pdMS_TO_TICKS(MOTOR_FF_CAL_REST_MS));
+
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
+    {
+        PwmMotor_Set_Decay(m);
+        for (int dir = 0; dir < PWM_MOTOR_DIR_MAX; dir++)
+        {
+            int sign = (dir == PWM_MOTOR_DIR_FORWARD) ? 1 : -1;
+            for (int j = 0; j < MOTOR_LUT_CAL_LEVELS; j++)
+            {
+                int duty = sign * PWM_MOTOR_DUTY_TICK_MAX * j / (MOTOR_LUT_CAL_LEVELS - 1);
+                PwmMotor_Set_Duty_All(duty, duty, duty, duty);
+                vTaskDelay(pdMS_TO_TICKS(MOTOR_LUT_CAL_STEP_MS - MOTOR_LUT_CAL_AVG_MS));
+
+                float sum[MOTOR_MAX_NUM] = {0};
+                for (int t = 0; t < samples; t++)
+                {
+                    vTaskDelay(pdMS_TO_TICKS(MOTOR_LUT_CAL_SAMPLE_MS));
+                    motor_speed_snapshot_t snapshot;
+                    Motor_Get_Speed_Snapshot(&snapshot);
+                    for (int i = 0; i < MOTOR_MAX_NUM; i++)
+                    {
+                        sum[i] += snapshot.speed[i] * sign;
+                    }
+                }
+                // 速度曲线取单调不减，去掉测量噪声造成的回折
+                // Keep the speed curve non-decreasing, removing folds caused by measurement noise
+                for (int i = 0; i < MOTOR_MAX_NUM; i++)
+                {
+                    float v = sum[i] / samples;
+                    if (j > 0 && v < curve[m][i][dir][j - 1]) v = curve[m][i][dir][j - 1];
+                    curve[m][i][dir][j] = (j == 0) ? 0 : v;
+                }
+            }
+            PwmMotor_Stop(MOTOR_ID_ALL, STOP_COAST);
+            vTaskDelay(pdMS_TO_TICKS(MOTOR_FF_CAL_REST_MS));
+        }
+    }
+    PwmMotor_Set_Decay(decay);
+
+    float v_full = MOTOR_MAX_SPEED * 10;
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            for (int dir = 0; dir < PWM_MOTOR_DIR_MAX; dir++)
+            {
+                float v_top = curve[m][i][dir][MOTOR_LUT_CAL_LEVELS - 1];
+                if (v_top < MOTOR_LUT_CAL_V_MIN * 4)
+                {
+                    ESP_LOGW(TAG, "M%d decay %d PWM linearization failed, top speed:%.3f", i + 1, m, v_top);
+                    return ESP_FAIL;
+                }
+                if (v_top < v_full) v_full = v_top;
+            }
+        }
+    }
+
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
+    {
+        for (int i = 0; i < MOTOR_MAX_NUM; i++)
+        {
+            for (int dir = 0; dir < PWM_MOTOR_DIR_MAX; dir++)
+            {
+                uint16_t duty[PWM_MOTOR_LUT_SIZE];
+                duty[0] = (uint16_t)lroundf(Motor_Lut_Inverse(curve[m][i][dir], MOTOR_LUT_CAL_V_MIN));
+                for (int k = 1; k < PWM_MOTOR_LUT_SIZE; k++)
+                {
+                    float speed = v_full * k / (PWM_MOTOR_LUT_SIZE - 1);
+                    if (speed < MOTOR_LUT_CAL_V_MIN) speed = MOTOR_LUT_CAL_V_MIN;
+                    duty[k] = (uint16_t)lroundf(Motor_Lut_Inverse(curve[m][i][dir], speed));
+                }
+                PwmMotor_Set_Lut(m, MOTOR_ID_M1 + i, dir, duty);
+            }
+            ESP_LOGI(TAG, "M%d decay %d LUT fwd top:%.2f rev top:%.2f", i + 1, m, curve[m][i][0][MOTOR_LUT_CAL_LEVELS - 1], curve[m][i][1][MOTOR_LUT_CAL_LEVELS - 1]);
+        }
+    }
+    ESP_LOGI(TAG, "PWM linearization full effort speed:%.2f m/s", v_full);
+    return Motor_Save_Lut();
+}
+
 // 初始化编码器电机
 // Initialize the encoder motor
 void Motor_Init(void)
@@ -176,6 +1561,15 @@ void Motor_Init(void)
     Encoder_Init();
     PwmMotor_Init();
 
+    if (Motor_Load_Lut() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Motor PWM linearization not calibrated, using the dead zone");
+    }
+    if (Motor_Load_FF() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Motor feed-forward not calibrated");
+    }
+
     xTaskCreatePinnedToCore(Motor_Task, "Motor_Task", 10*1024, NULL, 10, NULL, 1);
 }
 
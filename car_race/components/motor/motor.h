@@ -6,6 +6,9 @@ extern "C" {
 
 #include "stdbool.h"
 #include "stdint.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "pwm_motor.h"
 
 // 电机数量
@@ -14,20 +17,87 @@ extern "C" {
 #define MOTOR_ENCODER_CIRCLE            (1060)
 // 轮子周长，单位：mm
 #define MOTOR_WHEEL_CIRCLE              (204.2)
-// PID算法计算周期，单位：ms
+// PID参数和目标脉冲数的参考周期，单位：ms
 #define MOTOR_PID_PERIOD                (10)
+// 轮速控制频率，单位：Hz，需为100的整数倍，最高1000
+#define MOTOR_CTRL_RATE_HZ              (1000)
+// 轮速控制周期，单位：us
+#define MOTOR_CTRL_PERIOD_US            (1000000 / MOTOR_CTRL_RATE_HZ)
+// 轮速观测器带宽，单位：Hz
+#define MOTOR_OBSERVER_BW_HZ            (30)
+// 1：由硬件定时器中断触发控制循环，0：由vTaskDelayUntil按系统节拍触发
+#define MOTOR_CTRL_USE_TIMER            (1)
 // 设置电机最大速度，单位：ms/s。
 #define MOTOR_MAX_SPEED                 (1.0)
 
+// 前馈参数在NVS中的命名空间和键名
+#define MOTOR_NVS_NAMESPACE             "motor"
+#define MOTOR_NVS_KEY_FF                "ff"
+#define MOTOR_NVS_KEY_PID               "pid"
+#define MOTOR_NVS_KEY_LUT               "lut"
+
+
+// 电机前馈模型 u = ks*sign(v) + kv*v + ka*a，输出单位：电机出力(PWM线性化表的输入)
+// Motor feed-forward model u = ks*sign(v) + kv*v + ka*a, output unit: motor effort (input of the PWM linearization table)
+typedef struct _motor_ff {
+    float ks;           // 静摩擦 Static friction, effort
+    float kv;           // 速度增益 Velocity gain, effort/(m/s)
+    float ka;           // 加速度增益 Acceleration gain, effort/(m/s^2)
+} motor_ff_t;
+
+// 电机速度快照，四个轮子的速度来自同一个控制周期
+// Motor speed snapshot, the four wheel speeds come from the same control period
+typedef struct _motor_speed_snapshot {
+    float speed[MOTOR_MAX_NUM];     // 轮子速度 Wheel speed, m/s
+    int64_t time_us;                // 测量时间 Measurement time, esp_timer us
+    uint8_t slip_mask;              // 打滑轮子，bit0~3对应M1~M4 Slipping wheels, bit0~3 for M1~M4
+} motor_speed_snapshot_t;
+
+// 控制周期耗时，单位：CPU周期。平均值为最近一秒，最大值从上次Motor_Reset_Ctrl_Cycles()起累计
+// Control period cost, unit: CPU cycles. The averages cover the last second, the maxima accumulate since the last Motor_Reset_Ctrl_Cycles()
+typedef struct _motor_ctrl_cycles {
+    uint32_t ctrl_avg;              // Motor_PID_Ctrl平均 Motor_PID_Ctrl average
+    uint32_t ctrl_max;              // Motor_PID_Ctrl最大 Motor_PID_Ctrl maximum
+    uint32_t pwm_avg;               // PwmMotor_Set_Speed_All平均 PwmMotor_Set_Speed_All average
+    uint32_t pwm_max;               // PwmMotor_Set_Speed_All最大 PwmMotor_Set_Speed_All maximum
+} motor_ctrl_cycles_t;
+
+// 控制周期钩子，在每个控制周期的PID计算前调用：wheel_speed为四个轮子的实测速度，
+// wheel_setpoint为四个轮子的设定速度，可在钩子中修改，单位：m/s，dt单位：s
+// Control period hook, called before the PID calculation of every control period: wheel_speed is the measured speed of the four wheels,
+// wheel_setpoint is the setpoint speed of the four wheels and may be modified by the hook, unit: m/s, dt unit: s
+typedef void (*motor_ctrl_hook_t)(const float *wheel_speed, float *wheel_setpoint, float dt, void *arg);
 
 
 void Motor_Init(void);
 void Motor_Set_Speed(float speed_m1, float speed_m2, float speed_m3, float speed_m4);
 void Motor_Get_Speed(float* speed_m1, float* speed_m2, float* speed_m3, float* speed_m4);
+void Motor_Get_Speed_Snapshot(motor_speed_snapshot_t *snapshot);
+uint8_t Motor_Take_Slip_Mask(void);
 void Motor_Stop(bool brake);
+void Motor_Move_Distance(const float *distance, float max_speed, float max_accel, TaskHandle_t task, uint32_t notify_bits);
+bool Motor_Move_Done(void);
+void Motor_Set_Ctrl_Hook(motor_ctrl_hook_t hook, void *arg);
+void Motor_Get_Ctrl_Cycles(motor_ctrl_cycles_t *cycles);
+void Motor_Reset_Ctrl_Cycles(void);
 
 void Motor_Update_PID_Parm(float pid_p, float pid_i, float pid_d);
 void Motor_Read_PID_Parm(float* out_p, float* out_i, float* out_d);
+void Motor_Update_Wheel_PID_Parm(motor_id_t motor_id, float pid_p, float pid_i, float pid_d);
+void Motor_Read_Wheel_PID_Parm(motor_id_t motor_id, float* out_p, float* out_i, float* out_d);
+esp_err_t Motor_Load_PID(void);
+esp_err_t Motor_Save_PID(void);
+esp_err_t Motor_Auto_Tune_PID(void);
+
+void Motor_Set_FF(pwm_motor_decay_t decay, motor_id_t motor_id, const motor_ff_t *ff);
+void Motor_Get_FF(pwm_motor_decay_t decay, motor_id_t motor_id, motor_ff_t *ff);
+esp_err_t Motor_Load_FF(void);
+esp_err_t Motor_Save_FF(void);
+esp_err_t Motor_Calibrate_FF(void);
+
+esp_err_t Motor_Load_Lut(void);
+esp_err_t Motor_Save_Lut(void);
+esp_err_t Motor_Calibrate_Lut(void);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "esp_err.h"
+#include "pid_ctrl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Type of PID bank handle
+ *
+ * A PID bank holds N PID_CAL_TYPE_2DOF controllers in struct-of-arrays form and updates all of them in one call
+ *
+ */
+typedef struct pid_bank_t *pid_bank_handle_t;
+
+/**
+ * @brief PID bank configuration
+ *
+ */
+typedef struct {
+    int size;                        // Number of controllers in the bank
+    pid_ctrl_parameter_t init_param; // Initial parameters of every controller
+} pid_bank_config_t;
+
+/**
+ * @brief Create a new PID bank, all controllers share one allocation
+ *
+ * @param[in] config PID bank configuration
+ * @param[out] ret_bank Returned PID bank handle
+ * @return
+ *      - ESP_OK: Created PID bank successfully
+ *      - ESP_ERR_INVALID_ARG: Created PID bank failed because of invalid argument
+ *      - ESP_ERR_NO_MEM: Created PID bank failed because out of memory
+ */
+esp_err_t pid_new_bank(const pid_bank_config_t *config, pid_bank_handle_t *ret_bank);
+
+/**
+ * @brief Delete the PID bank
+ *
+ * @param[in] bank PID bank handle, created by `pid_new_bank()`
+ * @return
+ *      - ESP_OK: Delete PID bank successfully
+ *      - ESP_ERR_INVALID_ARG: Delete PID bank failed because of invalid argument
+ */
+esp_err_t pid_del_bank(pid_bank_handle_t bank);
+
+/**
+ * @brief Update the parameters of one controller in the bank
+ *
+ * @note Only the 2-DOF form is implemented, `cal_type` is ignored
+ *
+ * @param[in] bank PID bank handle, created by `pid_new_bank()`
+ * @param[in] index Controller index in the bank
+ * @param[in] params PID parameters
+ * @return
+ *      - ESP_OK: Update PID parameters successfully
+ *      - ESP_ERR_INVALID_ARG: Update PID parameters failed because of invalid argument
+ */
+esp_err_t pid_bank_update_parameters(pid_bank_handle_t bank, int index, const pid_ctrl_parameter_t *params);
+
+/**
+ * @brief Update the output limitation of one controller in the bank, without touching the other parameters and the state
+ *
+ * @param[in] bank PID bank handle, created by `pid_new_bank()`
+ * @param[in] index Controller index in the bank
+ * @param[in] min_output Minimum output limitation
+ * @param[in] max_output Maximum output limitation
+ * @return
+ *      - ESP_OK: Update PID output limitation successfully
+ *      - ESP_ERR_INVALID_ARG: Update PID output limitation failed because of invalid argument
+ */
+esp_err_t pid_bank_update_output_limit(pid_bank_handle_t bank, int index, float min_output, float max_output);
+
+/**
+ * @brief Reset the state of every controller in the bank
+ *
+ * @param[in] bank PID bank handle, created by `pid_new_bank()`
+ * @return
+ *      - ESP_OK: Reset PID bank successfully
+ *      - ESP_ERR_INVALID_ARG: Reset PID bank failed because of invalid argument
+ */
+esp_err_t pid_bank_reset(pid_bank_handle_t bank);
+
+/**
+ * @brief Run every controller in the bank once
+ *
+ * @note The output limitation and the anti-windup apply to the sum of the PID output and the feed-forward
+ *
+ * @param[in] bank PID bank handle, created by `pid_new_bank()`
+ * @param[in] setpoint Setpoints, `size` elements
+ * @param[in] measurement Measurements, `size` elements
+ * @param[in] feedforward Feed-forward added to the PID outputs, `size` elements, NULL for none
+ * @param[out] ret_result Results after PID calculation, `size` elements
+ * @return
+ *      - ESP_OK: Run a PID bank compute successfully
+ *      - ESP_ERR_INVALID_ARG: Run a PID bank compute failed because of invalid argument
+ */
+esp_err_t pid_bank_compute_2dof(pid_bank_handle_t bank, const float *setpoint, const float *measurement,
+                                const float *feedforward, float *ret_result);
+
+#ifdef __cplusplus
+}
+#endif
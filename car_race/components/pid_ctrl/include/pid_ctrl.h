@@ -19,6 +19,7 @@ extern "C" {
 typedef enum {
     PID_CAL_TYPE_INCREMENTAL, /*!< Incremental PID control */
     PID_CAL_TYPE_POSITIONAL,  /*!< Positional PID control */
+    PID_CAL_TYPE_2DOF,        /*!< Positional 2-DOF PID control with derivative filter and anti-windup */
 } pid_calculate_type_t;
 
 /**
@@ -40,6 +41,11 @@ typedef struct {
     float max_integral;            // PID maximum integral value limitation
     float min_integral;            // PID minimum integral value limitation
     pid_calculate_type_t cal_type; // PID calculation type
+    /* The following parameters are only used by PID_CAL_TYPE_2DOF */
+    float beta;                    // Setpoint weight of the proportional term, 1 = error feedback
+    float gamma;                   // Setpoint weight of the derivative term, 0 = derivative on measurement
+    float d_filter;                // Derivative low-pass filter coefficient in (0, 1], 1 = no filtering
+    float kb;                      // Back-calculation gain in [0, 1], 0 = conditional integration
 } pid_ctrl_parameter_t;
 
 /**
@@ -95,6 +101,47 @@ esp_err_t pid_update_parameters(pid_ctrl_block_handle_t pid, const pid_ctrl_para
  */
 esp_err_t pid_compute(pid_ctrl_block_handle_t pid, float input_error, float *ret_result);
 
+/**
+ * @brief Input setpoint and measurement and get PID control result
+ *
+ * @note For PID_CAL_TYPE_2DOF the proportional and derivative terms act on the weighted setpoint (beta, gamma),
+ *       other calculation types use the plain error `setpoint - measurement`.
+ *       Do not mix with `pid_compute()` on the same control block.
+ *
+ * @param[in] pid PID control block handle, created by `pid_new_control_block()`
+ * @param[in] setpoint setpoint of the controlled variable
+ * @param[in] measurement measurement of the controlled variable
+ * @param[out] ret_result result after PID calculation
+ * @return
+ *      - ESP_OK: Run a PID compute successfully
+ *      - ESP_ERR_INVALID_ARG: Run a PID compute failed because of invalid argument
+ */
+esp_err_t pid_compute_2dof(pid_ctrl_block_handle_t pid, float setpoint, float measurement, float *ret_result);
+
+/**
+ * @brief Update PID output limitation only, without touching the other parameters and the controller state
+ *
+ * @note Useful when a feed-forward term is added outside the controller, so the anti-windup sees the real saturation
+ *
+ * @param[in] pid PID control block handle, created by `pid_new_control_block()`
+ * @param[in] min_output PID minimum output limitation
+ * @param[in] max_output PID maximum output limitation
+ * @return
+ *      - ESP_OK: Update PID output limitation successfully
+ *      - ESP_ERR_INVALID_ARG: Update PID output limitation failed because of invalid argument
+ */
+esp_err_t pid_update_output_limit(pid_ctrl_block_handle_t pid, float min_output, float max_output);
+
+/**
+ * @brief Reset the PID controller state (errors, integral, filtered derivative and last output)
+ *
+ * @param[in] pid PID control block handle, created by `pid_new_control_block()`
+ * @return
+ *      - ESP_OK: Reset PID controller state successfully
+ *      - ESP_ERR_INVALID_ARG: Reset PID controller state failed because of invalid argument
+ */
+esp_err_t pid_reset_ctrl_block(pid_ctrl_block_handle_t pid);
+
 #ifdef __cplusplus
 }
 #endif
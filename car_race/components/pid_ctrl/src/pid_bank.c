@@ -0,0 +1,176 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "pid_bank.h"
+
+static const char *TAG = "pid_bank";
+
+/*
+ * Every field is an array of `size` floats, all arrays live in the same allocation right after the header.
+ * The per-controller loop has no function pointer and no per-controller argument check, and the compiler is free
+ * to keep the arrays streaming through registers. The ESP32-S3 PIE vector unit only has integer lanes, so the
+ * float math stays scalar on the FPU; any saving comes from the layout and from doing the checks once per bank.
+ * Whether that beats N separate control blocks depends on the compiler flags, measure it on the target.
+ */
+struct pid_bank_t {
+    int size;
+    bool d_primed;           // previous_d_input holds real samples, false after reset
+    float *kp;
+    float *ki;
+    float *kd;
+    float *beta;             // Setpoint weight of the proportional term
+    float *gamma;            // Setpoint weight of the derivative term
+    float *d_filter;         // Derivative low-pass filter coefficient
+    float *kb_ki;            // Back-calculation gain divided by Ki, 0 = conditional integration
+    float *max_output;
+    float *min_output;
+    float *max_integral;
+    float *min_integral;
+    float *integral_err;     // Sum of error
+    float *previous_d_input; // Derivative input in last control period
+    float *derivative;       // Filtered derivative term
+    float data[];
+};
+
+#define PID_BANK_FIELD_NUM  (14)
+
+esp_err_t pid_new_bank(const pid_bank_config_t *config, pid_bank_handle_t *ret_bank)
+{
+    esp_err_t ret = ESP_OK;
+    pid_bank_handle_t bank = NULL;
+    ESP_GOTO_ON_FALSE(config && ret_bank && config->size > 0, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+
+    int n = config->size;
+    bank = calloc(1, sizeof(struct pid_bank_t) + sizeof(float) * PID_BANK_FIELD_NUM * n);
+    ESP_GOTO_ON_FALSE(bank, ESP_ERR_NO_MEM, err, TAG, "no mem for PID bank");
+    bank->size = n;
+    bank->kp = bank->data;
+    bank->ki = bank->kp + n;
+    bank->kd = bank->ki + n;
+    bank->beta = bank->kd + n;
+    bank->gamma = bank->beta + n;
+    bank->d_filter = bank->gamma + n;
+    bank->kb_ki = bank->d_filter + n;
+    bank->max_output = bank->kb_ki + n;
+    bank->min_output = bank->max_output + n;
+    bank->max_integral = bank->min_output + n;
+    bank->min_integral = bank->max_integral + n;
+    bank->integral_err = bank->min_integral + n;
+    bank->previous_d_input = bank->integral_err + n;
+    bank->derivative = bank->previous_d_input + n;
+
+    for (int i = 0; i < n; i++) {
+        ESP_GOTO_ON_ERROR(pid_bank_update_parameters(bank, i, &config->init_param), err, TAG, "init PID parameters failed");
+    }
+    *ret_bank = bank;
+    return ret;
+
+err:
+    if (bank) {
+        free(bank);
+    }
+    return ret;
+}
+
+esp_err_t pid_del_bank(pid_bank_handle_t bank)
+{
+    ESP_RETURN_ON_FALSE(bank, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    free(bank);
+    return ESP_OK;
+}
+
+esp_err_t pid_bank_update_parameters(pid_bank_handle_t bank, int index, const pid_ctrl_parameter_t *params)
+{
+    ESP_RETURN_ON_FALSE(bank && params && index >= 0 && index < bank->size, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(params->d_filter > 0 && params->d_filter <= 1, ESP_ERR_INVALID_ARG, TAG, "invalid derivative filter:%f", params->d_filter);
+    /* The range check also rejects NaN */
+    ESP_RETURN_ON_FALSE(params->kb >= 0 && params->kb <= 1, ESP_ERR_INVALID_ARG, TAG, "invalid back-calculation gain:%f", params->kb);
+    bank->kp[index] = params->kp;
+    bank->ki[index] = params->ki;
+    bank->kd[index] = params->kd;
+    bank->beta[index] = params->beta;
+    bank->gamma[index] = params->gamma;
+    bank->d_filter[index] = params->d_filter;
+    bank->kb_ki[index] = (params->kb > 0 && params->ki != 0) ? params->kb / params->ki : 0;
+    bank->max_output[index] = params->max_output;
+    bank->min_output[index] = params->min_output;
+    bank->max_integral[index] = params->max_integral;
+    bank->min_integral[index] = params->min_integral;
+    return ESP_OK;
+}
+
+esp_err_t pid_bank_update_output_limit(pid_bank_handle_t bank, int index, float min_output, float max_output)
+{
+    ESP_RETURN_ON_FALSE(bank && index >= 0 && index < bank->size && min_output <= max_output, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    bank->min_output[index] = min_output;
+    bank->max_output[index] = max_output;
+    return ESP_OK;
+}
+
+esp_err_t pid_bank_reset(pid_bank_handle_t bank)
+{
+    ESP_RETURN_ON_FALSE(bank, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    for (int i = 0; i < bank->size; i++) {
+        bank->integral_err[i] = 0;
+        bank->previous_d_input[i] = 0;
+        bank->derivative[i] = 0;
+    }
+    bank->d_primed = false;
+    return ESP_OK;
+}
+
+esp_err_t pid_bank_compute_2dof(pid_bank_handle_t bank, const float *setpoint, const float *measurement,
+                                const float *feedforward, float *ret_result)
+{
+    ESP_RETURN_ON_FALSE(bank && setpoint && measurement && ret_result, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    int n = bank->size;
+    if (!bank->d_primed) {
+        /* First sample after a reset: no derivative kick from the step from zero */
+        for (int i = 0; i < n; i++) {
+            bank->previous_d_input[i] = bank->gamma[i] * setpoint[i] - measurement[i];
+        }
+        bank->d_primed = true;
+    }
+    for (int i = 0; i < n; i++) {
+        float sp = setpoint[i];
+        float pv = measurement[i];
+        float error = sp - pv;
+
+        /* Same algorithm as PID_CAL_TYPE_2DOF in pid_ctrl.c */
+        float p_term = (bank->beta[i] * sp - pv) * bank->kp[i];
+
+        float d_input = bank->gamma[i] * sp - pv;
+        float d_raw = (d_input - bank->previous_d_input[i]) * bank->kd[i];
+        float derivative = bank->derivative[i] + bank->d_filter[i] * (d_raw - bank->derivative[i]);
+        bank->derivative[i] = derivative;
+        bank->previous_d_input[i] = d_input;
+
+        float last_integral = bank->integral_err[i];
+        float integral = last_integral + error;
+        integral = MIN(integral, bank->max_integral[i]);
+        integral = MAX(integral, bank->min_integral[i]);
+
+        float unsaturated = p_term + integral * bank->ki[i] + derivative;
+        if (feedforward) {
+            unsaturated += feedforward[i];
+        }
+        float output = MIN(unsaturated, bank->max_output[i]);
+        output = MAX(output, bank->min_output[i]);
+
+        /* Anti-windup */
+        float excess = output - unsaturated;
+        if (excess != 0) {
+            if (bank->kb_ki[i] != 0) {
+                integral += bank->kb_ki[i] * excess;
+            } else if ((excess < 0 && error > 0) || (excess > 0 && error < 0)) {
+                integral = last_integral;
+            }
+        }
+        bank->integral_err[i] = integral;
+        ret_result[i] = output;
+    }
+    return ESP_OK;
+}
@@ -27,6 +27,13 @@ struct pid_ctrl_block_t {
     float min_output;   // PID minimum output limitation
     float max_integral; // PID maximum integral value limitation
     float min_integral; // PID minimum integral value limitation
+    float beta;         // Setpoint weight of the proportional term
+    float gamma;        // Setpoint weight of the derivative term
+    float d_filter;     // Derivative low-pass filter coefficient
+    float kb;           // Back-calculation gain, 0 = conditional integration
+    float previous_d_input; // Derivative input in last control period
+    bool d_primed;      // previous_d_input holds a real sample, false after reset
+    float derivative;   // Filtered derivative term
     pid_cal_func_t calculate_func; // calculation function, depends on actual PID type set by user
 };
 
@@ -81,6 +88,57 @@ static float pid_calc_incremental(pid_ctrl_block_t *pid, float error)
     return output;
 }
 
+static float pid_calc_2dof_weighted(pid_ctrl_block_t *pid, float setpoint, float measurement, float beta, float gamma)
+{
+    float error = setpoint - measurement;
+
+    /* Proportional term on the weighted setpoint */
+    float p_term = (beta * setpoint - measurement) * pid->Kp;
+
+    /* Derivative term on the weighted setpoint, first-order low-pass filtered */
+    /* D(k) = a*Kd*(ed(k)-ed(k-1)) + (1-a)*D(k-1) */
+    float d_input = gamma * setpoint - measurement;
+    if (!pid->d_primed) {
+        /* First sample after a reset: no derivative kick from the step from zero */
+        pid->previous_d_input = d_input;
+        pid->d_primed = true;
+    }
+    float d_raw = (d_input - pid->previous_d_input) * pid->Kd;
+    pid->derivative += pid->d_filter * (d_raw - pid->derivative);
+    pid->previous_d_input = d_input;
+
+    /* Integrate the error, limited by the integral range */
+    float last_integral = pid->integral_err;
+    pid->integral_err += error;
+    pid->integral_err = MIN(pid->integral_err, pid->max_integral);
+    pid->integral_err = MAX(pid->integral_err, pid->min_integral);
+
+    float unsaturated = p_term + pid->integral_err * pid->Ki + pid->derivative;
+    float output = MIN(unsaturated, pid->max_output);
+    output = MAX(output, pid->min_output);
+
+    /* Anti-windup */
+    if (output != unsaturated) {
+        if (pid->kb > 0 && pid->Ki != 0) {
+            /* Back-calculation: bleed the integral by part of the saturation excess */
+            pid->integral_err += pid->kb * (output - unsaturated) / pid->Ki;
+        } else if ((unsaturated > output && error > 0) || (unsaturated < output && error < 0)) {
+            /* Conditional integration: do not integrate further into saturation */
+            pid->integral_err = last_integral;
+        }
+    }
+
+    pid->previous_err1 = error;
+    pid->last_output = output;
+    return output;
+}
+
+static float pid_calc_2dof(pid_ctrl_block_t *pid, float error)
+{
+    /* Without a separate setpoint the weights reduce to plain error feedback */
+    return pid_calc_2dof_weighted(pid, error, 0, 1, 1);
+}
+
 esp_err_t pid_new_control_block(const pid_ctrl_config_t *config, pid_ctrl_block_handle_t *ret_pid)
 {
     esp_err_t ret = ESP_OK;
@@ -115,9 +173,43 @@ esp_err_t pid_compute(pid_ctrl_block_handle_t pid, float input_error, float *ret
     return ESP_OK;
 }
 
+esp_err_t pid_compute_2dof(pid_ctrl_block_handle_t pid, float setpoint, float measurement, float *ret_result)
+{
+    ESP_RETURN_ON_FALSE(pid && ret_result, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    if (pid->calculate_func == pid_calc_2dof) {
+        *ret_result = pid_calc_2dof_weighted(pid, setpoint, measurement, pid->beta, pid->gamma);
+    } else {
+        *ret_result = pid->calculate_func(pid, setpoint - measurement);
+    }
+    return ESP_OK;
+}
+
+esp_err_t pid_update_output_limit(pid_ctrl_block_handle_t pid, float min_output, float max_output)
+{
+    ESP_RETURN_ON_FALSE(pid && min_output <= max_output, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    pid->min_output = min_output;
+    pid->max_output = max_output;
+    return ESP_OK;
+}
+
+esp_err_t pid_reset_ctrl_block(pid_ctrl_block_handle_t pid)
+{
+    ESP_RETURN_ON_FALSE(pid, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    pid->previous_err1 = 0;
+    pid->previous_err2 = 0;
+    pid->integral_err = 0;
+    pid->last_output = 0;
+    pid->previous_d_input = 0;
+    pid->d_primed = false;
+    pid->derivative = 0;
+    return ESP_OK;
+}
+
 esp_err_t pid_update_parameters(pid_ctrl_block_handle_t pid, const pid_ctrl_parameter_t *params)
 {
     ESP_RETURN_ON_FALSE(pid && params, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    /* The range check also rejects NaN */
+    ESP_RETURN_ON_FALSE(params->kb >= 0 && params->kb <= 1, ESP_ERR_INVALID_ARG, TAG, "invalid back-calculation gain:%f", params->kb);
     pid->Kp = params->kp;
     pid->Ki = params->ki;
     pid->Kd = params->kd;
@@ -125,6 +217,10 @@ esp_err_t pid_update_parameters(pid_ctrl_block_handle_t pid, const pid_ctrl_para
     pid->min_output = params->min_output;
     pid->max_integral = params->max_integral;
     pid->min_integral = params->min_integral;
+    pid->beta = params->beta;
+    pid->gamma = params->gamma;
+    pid->d_filter = params->d_filter;
+    pid->kb = params->kb;
     /* Set the calculate function according to the PID type */
     switch (params->cal_type) {
     case PID_CAL_TYPE_INCREMENTAL:
@@ -133,6 +229,10 @@ esp_err_t pid_update_parameters(pid_ctrl_block_handle_t pid, const pid_ctrl_para
     case PID_CAL_TYPE_POSITIONAL:
         pid->calculate_func = pid_calc_positional;
         break;
+    case PID_CAL_TYPE_2DOF:
+        ESP_RETURN_ON_FALSE(params->d_filter > 0 && params->d_filter <= 1, ESP_ERR_INVALID_ARG, TAG, "invalid derivative filter:%f", params->d_filter);
+        pid->calculate_func = pid_calc_2dof;
+        break;
     default:
         ESP_RETURN_ON_FALSE(false, ESP_ERR_INVALID_ARG, TAG, "invalid PID calculation type:%d", params->cal_type);
     }
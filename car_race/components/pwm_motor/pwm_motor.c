@@ -1,6 +1,9 @@
 #include "pwm_motor.h"
 
 #include "stdio.h"
+#include "stdlib.h"
+#include "math.h"
+#include "stdatomic.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -8,13 +11,23 @@
 
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
 #include "driver/mcpwm_prelude.h"
+#include "driver/gpio.h"
+#include "esp_rom_sys.h"
 
 #include "bdc_motor.h"
+#include "battery.h"
 
 
 static const char *TAG = "PWM_MOTOR";
 
+_Static_assert(PWM_MOTOR_TIMER_RESOLUTION_HZ % PWM_MOTOR_FREQ_HZ == 0, "PWM frequency must divide the timer resolution");
+_Static_assert(PWM_MOTOR_DUTY_TICK_MAX >= 2 && PWM_MOTOR_DUTY_TICK_MAX <= 65535, "MCPWM period out of the 16-bit timer range");
+_Static_assert(PWM_MOTOR_DECAY_FAST == (int)BDC_MOTOR_DECAY_FAST && PWM_MOTOR_DECAY_SLOW == (int)BDC_MOTOR_DECAY_SLOW &&
+               PWM_MOTOR_DECAY_MIXED == (int)BDC_MOTOR_DECAY_MIXED, "decay modes must match bdc_motor");
+
 
 bdc_motor_handle_t motor_m1 = NULL;
 bdc_motor_handle_t motor_m2 = NULL;
@@ -23,13 +36,69 @@ bdc_motor_handle_t motor_m4 = NULL;
 
 static bool stop_brake = false;
 
-// 电机死区过滤
-// Motor dead zone filtering
-static int PwmMotor_Ignore_Dead_Zone(int speed)
+#define PWM_MOTOR_NUM                    (4)
+
+// 启动时测量逐个调用驱动(原来的做法)和带缓存批量更新每个控制周期的CPU周期数，结果打印在启动日志里，电机只输出1~2个tick
+// At startup the CPU cycles per control period of the per-call driver update (the former way) and of the cached batch update are measured
+// and printed in the boot log, the motors only get 1~2 ticks
+#define PWM_MOTOR_BENCHMARK_LOOPS        (1000)
+
+// 电机输出状态，UNKNOWN表示需要重新设置强制电平
+// Motor output state, UNKNOWN means the force levels must be set again
+typedef enum _pwm_motor_state {
+    PWM_MOTOR_STATE_UNKNOWN = 0,
+    PWM_MOTOR_STATE_FORWARD,
+    PWM_MOTOR_STATE_REVERSE,
+    PWM_MOTOR_STATE_COAST,
+    PWM_MOTOR_STATE_BRAKE,
+} pwm_motor_state_t;
+
+// 每个电机的句柄、已设置的输出状态和比较值，只在状态或比较值变化时调用驱动
+// Handle, applied output state and compare value of each motor, the driver is only called when the state or the compare value changes
+static bdc_motor_handle_t motor_handle[PWM_MOTOR_NUM] = {0};
+static pwm_motor_state_t motor_state[PWM_MOTOR_NUM] = {0};
+static uint32_t motor_compare[PWM_MOTOR_NUM] = {0};
+
+// 每个MCPWM组的GPIO同步源，同一引脚，收到同步信号时组内定时器计数清零
+// GPIO sync source of each MCPWM group, same pin, the timers of the group restart from zero on a sync event
+#define PWM_MOTOR_GROUP_NUM              (2)
+static mcpwm_sync_handle_t motor_sync[PWM_MOTOR_GROUP_NUM] = {0};
+
+// 请求的和已设置的衰减方式，请求可在任意任务中修改，在电机任务输出时生效
+// Requested and applied decay mode, the request may come from any task and takes effect in the motor task on the next output
+static volatile pwm_motor_decay_t decay_request = PWM_MOTOR_DECAY_DEFAULT;
+static pwm_motor_decay_t decay_applied = PWM_MOTOR_DECAY_DEFAULT;
+
+// 电池电压补偿状态
+// 电池电压补偿状态：滤波和补偿系数计算在周期定时器里完成，控制周期只原子地读取补偿系数，不碰ADC
+// Battery voltage compensation state: the filtering and the scale are computed in a periodic timer, the control period only loads the scale atomically and never touches the ADC
+static bool vbat_comp_enable = PWM_MOTOR_VBAT_COMP;
+static float vbat_filtered = 0;
+static _Atomic float vbat_scale = 1.0f;
+static esp_timer_handle_t vbat_timer = NULL;
+
+// 线性化表，每种衰减方式、每个电机、每个转向一张，输入出力到PWM duty；pwm_lut_active指向当前衰减方式的一套
+// Linearization tables, one per decay mode, motor and direction, input effort to PWM duty; pwm_lut_active points to the set of the applied decay mode
+static uint16_t pwm_lut[PWM_MOTOR_DECAY_MAX][PWM_MOTOR_NUM][PWM_MOTOR_DIR_MAX][PWM_MOTOR_LUT_SIZE] = {0};
+static uint16_t (*pwm_lut_active)[PWM_MOTOR_DIR_MAX][PWM_MOTOR_LUT_SIZE] = pwm_lut[PWM_MOTOR_DECAY_DEFAULT];
+
+// 按线性化表把出力换算成带符号的duty，出力为0时输出0
+// Convert the effort to a signed duty with the linearization table, zero effort gives zero duty
+static int PwmMotor_Lut_Duty(int index, int speed)
 {
-    if (speed > 0) return speed + PWM_MOTOR_DEAD_ZONE;
-    if (speed < 0) return speed - PWM_MOTOR_DEAD_ZONE;
-    return 0;
+    if (speed == 0) return 0;
+    const uint16_t *lut = pwm_lut_active[index][speed > 0 ? PWM_MOTOR_DIR_FORWARD : PWM_MOTOR_DIR_REVERSE];
+    int effort = abs(speed);
+    if (effort > PWM_MOTOR_MAX_VALUE) effort = PWM_MOTOR_MAX_VALUE;
+
+    int pos = effort * (PWM_MOTOR_LUT_SIZE - 1);
+    int k = pos / PWM_MOTOR_MAX_VALUE;
+    int duty = lut[k];
+    if (k < PWM_MOTOR_LUT_SIZE - 1)
+    {
+        duty += (lut[k + 1] - lut[k]) * (pos % PWM_MOTOR_MAX_VALUE) / PWM_MOTOR_MAX_VALUE;
+    }
+    return speed > 0 ? duty : -duty;
 }
 
 // 限制输入最大值和最小值。
@@ -41,6 +110,71 @@ static int PwmMotor_Limit_Speed(int speed)
     return speed;
 }
 
+// 电池电压补偿定时器回调：对电池电压做一阶低通滤波并发布补偿系数。电压取Battery_Task采样的缓存值，ADC只在该低优先级任务里读取
+// Battery voltage compensation timer callback: low-pass filter the battery voltage and publish the compensation scale.
+// The voltage is the cached sample of Battery_Task, the ADC is only read in that low priority task
+static void PwmMotor_Vbat_Callback(void *arg)
+{
+    float voltage = Battery_Get_Voltage();
+    if (voltage < PWM_MOTOR_VBAT_MIN)
+    {
+        vbat_filtered = 0;
+        atomic_store_explicit(&vbat_scale, 1.0f, memory_order_relaxed);
+        return;
+    }
+    if (vbat_filtered <= 0) vbat_filtered = voltage;
+    else vbat_filtered += (voltage - vbat_filtered) * ((float)PWM_MOTOR_VBAT_PERIOD_MS / PWM_MOTOR_VBAT_TAU_MS);
+
+    float scale = PWM_MOTOR_VBAT_NOMINAL / vbat_filtered;
+    if (scale < PWM_MOTOR_VBAT_SCALE_MIN) scale = PWM_MOTOR_VBAT_SCALE_MIN;
+    if (scale > PWM_MOTOR_VBAT_SCALE_MAX) scale = PWM_MOTOR_VBAT_SCALE_MAX;
+    atomic_store_explicit(&vbat_scale, scale, memory_order_relaxed);
+}
+
+// 电池电压补偿，对线性化表输出的总duty缩放，起转PWM本身也随电压变化
+// Battery voltage compensation, scales the total duty out of the linearization table since the breakaway PWM also moves with the voltage
+static int PwmMotor_Vbat_Compensate(int speed)
+{
+    if (!vbat_comp_enable || speed == 0) return speed;
+    return (int)lroundf(speed * atomic_load_explicit(&vbat_scale, memory_order_relaxed));
+}
+
+// 为每个MCPWM组创建同步源，引脚先保持低电平
+// Create the sync source of each MCPWM group, the pin is held low first
+static void PwmMotor_Init_Sync(void)
+{
+    gpio_config_t io_config = {
+        .pin_bit_mask = 1ULL << PWM_MOTOR_SYNC_GPIO,
+        .mode = GPIO_MODE_INPUT_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io_config));
+    ESP_ERROR_CHECK(gpio_set_level(PWM_MOTOR_SYNC_GPIO, 0));
+
+    for (int i = 0; i < PWM_MOTOR_GROUP_NUM; i++)
+    {
+        mcpwm_gpio_sync_src_config_t sync_config = {
+            .group_id = i,
+            .gpio_num = PWM_MOTOR_SYNC_GPIO,
+            .flags.pull_down = true,
+            .flags.io_loop_back = true,
+        };
+        ESP_ERROR_CHECK(mcpwm_new_gpio_sync_src(&sync_config, &motor_sync[i]));
+    }
+}
+
+// 同步引脚输出一个上升沿，四路定时器同时从0开始计数，之后四路PWM的周期起点一致，比较值都在计数清零时生效
+// Drive one rising edge on the sync pin, all four timers restart from zero together, afterwards the four PWM periods start
+// at the same instant and every compare value takes effect at the timer zero
+static void PwmMotor_Sync_Timer(void)
+{
+    ESP_ERROR_CHECK(gpio_set_level(PWM_MOTOR_SYNC_GPIO, 1));
+    esp_rom_delay_us(1);
+    ESP_ERROR_CHECK(gpio_set_level(PWM_MOTOR_SYNC_GPIO, 0));
+}
+
 // 初始化电机1，绑定GPIO和配置定时器
 // Initialize motor 1, bind GPIO and configure timer
 static void PwmMotor_Init_M1(void)
@@ -53,6 +187,8 @@ static void PwmMotor_Init_M1(void)
     bdc_motor_mcpwm_config_t mcpwm_config = {
         .group_id = PWM_MOTOR_TIMER_GROUP_ID_M1,
         .resolution_hz = PWM_MOTOR_TIMER_RESOLUTION_HZ,
+        .sync_src = motor_sync[PWM_MOTOR_TIMER_GROUP_ID_M1],
+        .decay = (bdc_motor_decay_t)PWM_MOTOR_DECAY_DEFAULT,
     };
     bdc_motor_handle_t motor = NULL;
     ESP_ERROR_CHECK(bdc_motor_new_mcpwm_device(&motor_config, &mcpwm_config, &motor));
@@ -72,6 +208,8 @@ static void PwmMotor_Init_M2(void)
     bdc_motor_mcpwm_config_t mcpwm_config = {
         .group_id = PWM_MOTOR_TIMER_GROUP_ID_M2,
         .resolution_hz = PWM_MOTOR_TIMER_RESOLUTION_HZ,
+        .sync_src = motor_sync[PWM_MOTOR_TIMER_GROUP_ID_M2],
+        .decay = (bdc_motor_decay_t)PWM_MOTOR_DECAY_DEFAULT,
     };
     bdc_motor_handle_t motor = NULL;
     ESP_ERROR_CHECK(bdc_motor_new_mcpwm_device(&motor_config, &mcpwm_config, &motor));
@@ -91,6 +229,8 @@ static void PwmMotor_Init_M3(void)
     bdc_motor_mcpwm_config_t mcpwm_config = {
         .group_id = PWM_MOTOR_TIMER_GROUP_ID_M3,
         .resolution_hz = PWM_MOTOR_TIMER_RESOLUTION_HZ,
+        .sync_src = motor_sync[PWM_MOTOR_TIMER_GROUP_ID_M3],
+        .decay = (bdc_motor_decay_t)PWM_MOTOR_DECAY_DEFAULT,
     };
     bdc_motor_handle_t motor = NULL;
     ESP_ERROR_CHECK(bdc_motor_new_mcpwm_device(&motor_config, &mcpwm_config, &motor));
@@ -110,6 +250,8 @@ static void PwmMotor_Init_M4(void)
     bdc_motor_mcpwm_config_t mcpwm_config = {
         .group_id = PWM_MOTOR_TIMER_GROUP_ID_M4,
         .resolution_hz = PWM_MOTOR_TIMER_RESOLUTION_HZ,
+        .sync_src = motor_sync[PWM_MOTOR_TIMER_GROUP_ID_M4],
+        .decay = (bdc_motor_decay_t)PWM_MOTOR_DECAY_DEFAULT,
     };
     bdc_motor_handle_t motor = NULL;
     ESP_ERROR_CHECK(bdc_motor_new_mcpwm_device(&motor_config, &mcpwm_config, &motor));
@@ -117,176 +259,279 @@ static void PwmMotor_Init_M4(void)
     motor_m4 = motor;
 }
 
-// 控制电机1速度，speed的输入范围：±PWM_MOTOR_MAX_VALUE
-// Control motor 1 speed, speed input range: ±PWM_MOTOR_MAX_VALUE
-static void PwmMotor_Set_Speed_M1(int speed)
+// 把带符号的duty换算成电机状态和比较值：先做电池电压补偿再限幅，duty为0时按最近一次停止方式刹车或滑行
+// Turn a signed duty into the motor state and the compare value: battery compensated then limited, zero duty brakes or coasts according to the last stop mode
+static pwm_motor_state_t PwmMotor_Duty_State(int duty, uint32_t *compare)
 {
-    speed = PwmMotor_Ignore_Dead_Zone(speed);
-    speed = PwmMotor_Limit_Speed(speed);
+    duty = PwmMotor_Vbat_Compensate(duty);
+    duty = PwmMotor_Limit_Speed(duty);
+    *compare = abs(duty);
+    if (duty > 0) return PWM_MOTOR_STATE_FORWARD;
+    if (duty < 0) return PWM_MOTOR_STATE_REVERSE;
+    return stop_brake ? PWM_MOTOR_STATE_BRAKE : PWM_MOTOR_STATE_COAST;
+}
 
-    if (speed > 0) // forward
-    {
-        ESP_ERROR_CHECK(bdc_motor_forward(motor_m1));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m1, speed));
-    }
-    else if (speed < 0) // back
-    {
-        ESP_ERROR_CHECK(bdc_motor_reverse(motor_m1));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m1, -speed));
-    }
-    else // stop
-    {
-        if (stop_brake) ESP_ERROR_CHECK(bdc_motor_brake(motor_m1));
-        else ESP_ERROR_CHECK(bdc_motor_coast(motor_m1));
-    }
+// 电机状态与缓存不同时才切换强制电平
+// Switch the force levels only when the motor state differs from the cached one
+static void PwmMotor_Apply_State(int index, pwm_motor_state_t state)
+{
+    if (motor_state[index] == state) return;
+    bdc_motor_handle_t motor = motor_handle[index];
+    if (state == PWM_MOTOR_STATE_FORWARD) ESP_ERROR_CHECK(bdc_motor_forward(motor));
+    else if (state == PWM_MOTOR_STATE_REVERSE) ESP_ERROR_CHECK(bdc_motor_reverse(motor));
+    else if (state == PWM_MOTOR_STATE_BRAKE) ESP_ERROR_CHECK(bdc_motor_brake(motor));
+    else ESP_ERROR_CHECK(bdc_motor_coast(motor));
+    motor_state[index] = state;
 }
 
-// 控制电机2速度，speed的输入范围：±PWM_MOTOR_MAX_VALUE
-// Control motor 2 speed, speed input range: ±PWM_MOTOR_MAX_VALUE
-static void PwmMotor_Set_Speed_M2(int speed)
+// 比较值与缓存不同时才写入，停止时不写
+// Write the compare value only when it differs from the cached one, nothing is written when stopped
+static void PwmMotor_Apply_Compare(int index, uint32_t compare)
 {
-    speed = PwmMotor_Ignore_Dead_Zone(speed);
-    speed = PwmMotor_Limit_Speed(speed);
+    if (compare == 0 || motor_compare[index] == compare) return;
+    ESP_ERROR_CHECK(bdc_motor_set_speed(motor_handle[index], compare));
+    motor_compare[index] = compare;
+}
 
-    if (speed > 0) // forward
+// 衰减方式有新请求时切换四个电机和线性化表，电机正在转动时立即生效
+// Switch the four motors and the linearization tables when a new decay mode is requested, it takes effect immediately on running motors
+static void PwmMotor_Apply_Decay(void)
+{
+    pwm_motor_decay_t decay = decay_request;
+    if (decay == decay_applied) return;
+    for (int i = 0; i < PWM_MOTOR_NUM; i++)
     {
-        ESP_ERROR_CHECK(bdc_motor_forward(motor_m2));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m2, speed));
+        ESP_ERROR_CHECK(bdc_motor_set_decay(motor_handle[i], (bdc_motor_decay_t)decay));
     }
-    else if (speed < 0) // back
+    pwm_lut_active = pwm_lut[decay];
+    decay_applied = decay;
+}
+
+// 输出四个电机带符号的duty：先切换转向有变化的电机，再一次写完所有比较值
+// Output the signed duties of the four motors: switch the motors whose direction changed first, then write all compare values in one pass
+static void PwmMotor_Output_All(const int *duty)
+{
+    uint32_t compare[PWM_MOTOR_NUM];
+    PwmMotor_Apply_Decay();
+    for (int i = 0; i < PWM_MOTOR_NUM; i++)
     {
-        ESP_ERROR_CHECK(bdc_motor_reverse(motor_m2));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m2, -speed));
+        PwmMotor_Apply_State(i, PwmMotor_Duty_State(duty[i], &compare[i]));
     }
-    else // stop
+    for (int i = 0; i < PWM_MOTOR_NUM; i++)
     {
-        if (stop_brake) ESP_ERROR_CHECK(bdc_motor_brake(motor_m2));
-        else ESP_ERROR_CHECK(bdc_motor_coast(motor_m2));
+        PwmMotor_Apply_Compare(i, compare[i]);
     }
 }
 
-// 控制电机3速度，speed的输入范围：±PWM_MOTOR_MAX_VALUE
-// Control motor 3 speed, speed input range: ±PWM_MOTOR_MAX_VALUE
-static void PwmMotor_Set_Speed_M3(int speed)
+// 输出一个电机带符号的duty
+// Output the signed duty of one motor
+static void PwmMotor_Output(int index, int duty)
+{
+    uint32_t compare = 0;
+    PwmMotor_Apply_Decay();
+    PwmMotor_Apply_State(index, PwmMotor_Duty_State(duty, &compare));
+    PwmMotor_Apply_Compare(index, compare);
+}
+
+// 控制电机转动。speed输入范围：±PWM_MOTOR_MAX_VALUE
+// Control motor rotation. speed input range: ±PWM_MOTOR_MAX_VALUE
+void PwmMotor_Set_Speed_All(int speed_1, int speed_2, int speed_3, int speed_4)
 {
-    speed = PwmMotor_Ignore_Dead_Zone(speed);
-    speed = PwmMotor_Limit_Speed(speed);
+    // 先切换衰减方式，查表用新方式的线性化表
+    // Switch the decay mode first so the lookup uses the table of the new mode
+    PwmMotor_Apply_Decay();
+    int duty[PWM_MOTOR_NUM] = {
+        PwmMotor_Lut_Duty(0, speed_1),
+        PwmMotor_Lut_Duty(1, speed_2),
+        PwmMotor_Lut_Duty(2, speed_3),
+        PwmMotor_Lut_Duty(3, speed_4),
+    };
+    PwmMotor_Output_All(duty);
+}
 
-    if (speed > 0) // forward
+// 通过电机ID号控制电机转动。speed输入范围：±PWM_MOTOR_MAX_VALUE
+// Motor rotation is controlled by motor ID number. speed input range: ±PWM_MOTOR_MAX_VALUE
+void PwmMotor_Set_Speed(motor_id_t motor_id, int speed)
+{
+    if (motor_id == MOTOR_ID_ALL)
     {
-        ESP_ERROR_CHECK(bdc_motor_forward(motor_m3));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m3, speed));
+        PwmMotor_Set_Speed_All(speed, speed, speed, speed);
     }
-    else if (speed < 0) // back
+    else if (motor_id >= MOTOR_ID_M1 && motor_id <= MOTOR_ID_M4)
     {
-        ESP_ERROR_CHECK(bdc_motor_reverse(motor_m3));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m3, -speed));
+        int index = motor_id - MOTOR_ID_M1;
+        PwmMotor_Apply_Decay();
+            PwmMotor_Output(index, PwmMotor_Lut_Duty(index, speed));
     }
-    else // stop
+}
+
+// 停止电机，按零duty走同一条缓存路径，已处于该停止方式的电机不再调用驱动。
+// 与其他输出函数一样不可重入，只能由当前驱动电机的任务调用
+// Stop motor, a zero duty goes through the same cached path, motors already in this stop mode are not touched.
+// Not reentrant like the other output functions, only the task currently driving the motors may call it
+void PwmMotor_Stop(motor_id_t motor_id, bool brake)
+{
+    stop_brake = brake;
+    for (int i = 0; i < PWM_MOTOR_NUM; i++)
     {
-        if (stop_brake) ESP_ERROR_CHECK(bdc_motor_brake(motor_m3));
-        else ESP_ERROR_CHECK(bdc_motor_coast(motor_m3));
+        if (motor_id != MOTOR_ID_ALL && motor_id != MOTOR_ID_M1 + i) continue;
+        PwmMotor_Output(i, 0);
     }
 }
 
-// 控制电机4速度，speed的输入范围：±PWM_MOTOR_MAX_VALUE
-// Control motor 4 speed, speed input range: ±PWM_MOTOR_MAX_VALUE
-static void PwmMotor_Set_Speed_M4(int speed)
+// 不经过线性化表直接输出duty，用于标定。duty输入范围：±PWM_MOTOR_DUTY_TICK_MAX
+// Output the duty directly without the linearization table, used for calibration. duty input range: ±PWM_MOTOR_DUTY_TICK_MAX
+void PwmMotor_Set_Duty_All(int duty_1, int duty_2, int duty_3, int duty_4)
 {
-    speed = PwmMotor_Ignore_Dead_Zone(speed);
-    speed = PwmMotor_Limit_Speed(speed);
+    int duty[PWM_MOTOR_NUM] = {duty_1, duty_2, duty_3, duty_4};
+    PwmMotor_Output_All(duty);
+}
 
-    if (speed > 0) // forward
+// 设置一种衰减方式下一个电机一个转向的线性化表，共PWM_MOTOR_LUT_SIZE点，需单调不减，超出PWM最大值的部分被截断。电机停止时调用
+// Set the linearization table of one decay mode, motor and direction, PWM_MOTOR_LUT_SIZE points, must not decrease, values above the PWM maximum are clipped. Call with the motors stopped
+void PwmMotor_Set_Lut(pwm_motor_decay_t decay, motor_id_t motor_id, pwm_motor_dir_t dir, const uint16_t *duty)
+{
+    if (decay >= PWM_MOTOR_DECAY_MAX || motor_id < MOTOR_ID_M1 || motor_id > MOTOR_ID_M4 || dir >= PWM_MOTOR_DIR_MAX) return;
+    uint16_t *lut = pwm_lut[decay][motor_id - MOTOR_ID_M1][dir];
+    uint16_t last = 0;
+    for (int k = 0; k < PWM_MOTOR_LUT_SIZE; k++)
     {
-        ESP_ERROR_CHECK(bdc_motor_forward(motor_m4));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m4, speed));
+        uint16_t value = duty[k];
+        if (value > PWM_MOTOR_DUTY_TICK_MAX) value = PWM_MOTOR_DUTY_TICK_MAX;
+        if (value < last) value = last;
+        lut[k] = value;
+        last = value;
     }
-    else if (speed < 0) // back
+}
+
+// 读取一种衰减方式下一个电机一个转向的线性化表
+// Read the linearization table of one decay mode, motor and direction
+void PwmMotor_Get_Lut(pwm_motor_decay_t decay, motor_id_t motor_id, pwm_motor_dir_t dir, uint16_t *duty)
+{
+    if (decay >= PWM_MOTOR_DECAY_MAX || motor_id < MOTOR_ID_M1 || motor_id > MOTOR_ID_M4 || dir >= PWM_MOTOR_DIR_MAX) return;
+    const uint16_t *lut = pwm_lut[decay][motor_id - MOTOR_ID_M1][dir];
+    for (int k = 0; k < PWM_MOTOR_LUT_SIZE; k++)
     {
-        ESP_ERROR_CHECK(bdc_motor_reverse(motor_m4));
-        ESP_ERROR_CHECK(bdc_motor_set_speed(motor_m4, -speed));
+        duty[k] = lut[k];
     }
-    else // stop
+}
+
+// 恢复默认线性化表：所有衰减方式、所有电机从PWM_MOTOR_DEAD_ZONE线性到PWM最大值
+// Restore the default linearization table: every decay mode and motor linear from PWM_MOTOR_DEAD_ZONE to the PWM maximum
+void PwmMotor_Reset_Lut(void)
+{
+    for (int m = 0; m < PWM_MOTOR_DECAY_MAX; m++)
     {
-        if (stop_brake) ESP_ERROR_CHECK(bdc_motor_brake(motor_m4));
-        else ESP_ERROR_CHECK(bdc_motor_coast(motor_m4));
+        for (int i = 0; i < PWM_MOTOR_NUM; i++)
+        {
+            for (int dir = 0; dir < PWM_MOTOR_DIR_MAX; dir++)
+            {
+                for (int k = 0; k < PWM_MOTOR_LUT_SIZE; k++)
+                {
+                    pwm_lut[m][i][dir][k] = PWM_MOTOR_DEAD_ZONE + PWM_MOTOR_MAX_VALUE * k / (PWM_MOTOR_LUT_SIZE - 1);
+                }
+            }
+        }
     }
 }
 
+// 打开或关闭电池电压补偿
+// Enable or disable the battery voltage compensation
+void PwmMotor_Set_Vbat_Compensation(bool enable)
+{
+    vbat_comp_enable = enable;
+}
 
+// 读取当前电池电压补偿系数，未补偿时为1
+// Read the current battery voltage compensation scale, 1 when not compensating
+float PwmMotor_Get_Vbat_Scale(void)
+{
+    return vbat_comp_enable ? atomic_load_explicit(&vbat_scale, memory_order_relaxed) : 1.0f;
+}
 
-// 控制电机转动。speed输入范围：±PWM_MOTOR_MAX_VALUE
-// Control motor rotation. speed input range: ±PWM_MOTOR_MAX_VALUE
-void PwmMotor_Set_Speed_All(int speed_1, int speed_2, int speed_3, int speed_4)
+// 设置电流衰减方式，四个电机同时切换，在下一次输出时生效
+// Set the current decay mode of the four motors together, it takes effect on the next output
+void PwmMotor_Set_Decay(pwm_motor_decay_t decay)
 {
-    PwmMotor_Set_Speed_M1(speed_1);
-    PwmMotor_Set_Speed_M2(speed_2);
-    PwmMotor_Set_Speed_M3(speed_3);
-    PwmMotor_Set_Speed_M4(speed_4);
+    if (decay >= PWM_MOTOR_DECAY_MAX) return;
+    decay_request = decay;
 }
 
-// 通过电机ID号控制电机转动。speed输入范围：±PWM_MOTOR_MAX_VALUE
-// Motor rotation is controlled by motor ID number. speed input range: ±PWM_MOTOR_MAX_VALUE
-void PwmMotor_Set_Speed(motor_id_t motor_id, int speed)
+// 读取请求的电流衰减方式
+// Read the requested current decay mode
+pwm_motor_decay_t PwmMotor_Get_Decay(void)
 {
-    if (motor_id == MOTOR_ID_M1) PwmMotor_Set_Speed_M1(speed);
-    else if (motor_id == MOTOR_ID_M2) PwmMotor_Set_Speed_M2(speed);
-    else if (motor_id == MOTOR_ID_M3) PwmMotor_Set_Speed_M3(speed);
-    else if (motor_id == MOTOR_ID_M4) PwmMotor_Set_Speed_M4(speed);
-    else if (motor_id == MOTOR_ID_ALL)
-    {
-        PwmMotor_Set_Speed_M1(speed);
-        PwmMotor_Set_Speed_M2(speed);
-        PwmMotor_Set_Speed_M3(speed);
-        PwmMotor_Set_Speed_M4(speed);
-    }
+    return decay_request;
 }
 
-// 停止电机
-// Stop motor
-void PwmMotor_Stop(motor_id_t motor_id, bool brake)
+// 比较逐个电机调用转向和比较值驱动(每周期16次驱动调用)与带缓存批量更新每个控制周期的CPU周期数，
+// duty在1和2个tick之间交替，比较值每周期都变化，转向不变
+// Compare the CPU cycles per control period of calling the direction and compare drivers for every motor (16 driver calls per period)
+// and of the cached batch update; the duty alternates between 1 and 2 ticks so the compare changes every period while the direction stays
+static void PwmMotor_Benchmark(void)
 {
-    if (brake)
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (int k = 0; k < PWM_MOTOR_BENCHMARK_LOOPS; k++)
     {
-        if (motor_id == MOTOR_ID_M1) ESP_ERROR_CHECK(bdc_motor_brake(motor_m1));
-        else if (motor_id == MOTOR_ID_M2) ESP_ERROR_CHECK(bdc_motor_brake(motor_m2));
-        else if (motor_id == MOTOR_ID_M3) ESP_ERROR_CHECK(bdc_motor_brake(motor_m3));
-        else if (motor_id == MOTOR_ID_M4) ESP_ERROR_CHECK(bdc_motor_brake(motor_m4));
-        else if (motor_id == MOTOR_ID_ALL)
+        uint32_t duty = 1 + (k & 1);
+        for (int i = 0; i < PWM_MOTOR_NUM; i++)
         {
-            ESP_ERROR_CHECK(bdc_motor_brake(motor_m1));
-            ESP_ERROR_CHECK(bdc_motor_brake(motor_m2));
-            ESP_ERROR_CHECK(bdc_motor_brake(motor_m3));
-            ESP_ERROR_CHECK(bdc_motor_brake(motor_m4));
+            ESP_ERROR_CHECK(bdc_motor_forward(motor_handle[i]));
+            ESP_ERROR_CHECK(bdc_motor_set_speed(motor_handle[i], duty));
         }
-        stop_brake = true;
     }
-    else
+    uint32_t direct_cycles = esp_cpu_get_cycle_count() - start;
+
+    // 直接调用驱动绕过了缓存，批量更新前先让缓存失效
+    // The direct driver calls bypassed the cache, invalidate it before the batch update
+    for (int i = 0; i < PWM_MOTOR_NUM; i++)
     {
-        if (motor_id == MOTOR_ID_M1) ESP_ERROR_CHECK(bdc_motor_coast(motor_m1));
-        else if (motor_id == MOTOR_ID_M2) ESP_ERROR_CHECK(bdc_motor_coast(motor_m2));
-        else if (motor_id == MOTOR_ID_M3) ESP_ERROR_CHECK(bdc_motor_coast(motor_m3));
-        else if (motor_id == MOTOR_ID_M4) ESP_ERROR_CHECK(bdc_motor_coast(motor_m4));
-        else if (motor_id == MOTOR_ID_ALL)
-        {
-            ESP_ERROR_CHECK(bdc_motor_coast(motor_m1));
-            ESP_ERROR_CHECK(bdc_motor_coast(motor_m2));
-            ESP_ERROR_CHECK(bdc_motor_coast(motor_m3));
-            ESP_ERROR_CHECK(bdc_motor_coast(motor_m4));
-        }
-        stop_brake = false;
+        motor_state[i] = PWM_MOTOR_STATE_UNKNOWN;
+        motor_compare[i] = 0;
+    }
+    start = esp_cpu_get_cycle_count();
+    for (int k = 0; k < PWM_MOTOR_BENCHMARK_LOOPS; k++)
+    {
+        int duty = 1 + (k & 1);
+        int batch[PWM_MOTOR_NUM] = {duty, duty, duty, duty};
+        PwmMotor_Output_All(batch);
     }
+    uint32_t batch_cycles = esp_cpu_get_cycle_count() - start;
+
+    ESP_LOGI(TAG, "PWM update cycles per tick, direct:%u batch:%u", (unsigned int)(direct_cycles / PWM_MOTOR_BENCHMARK_LOOPS),
+             (unsigned int)(batch_cycles / PWM_MOTOR_BENCHMARK_LOOPS));
+    PwmMotor_Stop(MOTOR_ID_ALL, false);
 }
 
 // 初始化电机
 // Initial motor
 void PwmMotor_Init(void)
 {
-    ESP_LOGI(TAG, "Init PwmMotor Device");
+    ESP_LOGI(TAG, "Init PwmMotor Device, %d Hz, %d ticks", PWM_MOTOR_FREQ_HZ, PWM_MOTOR_DUTY_TICK_MAX);
+    PwmMotor_Reset_Lut();
 
+    PwmMotor_Init_Sync();
     PwmMotor_Init_M1();
     PwmMotor_Init_M2();
     PwmMotor_Init_M3();
     PwmMotor_Init_M4();
+    PwmMotor_Sync_Timer();
+    motor_handle[0] = motor_m1;
+    motor_handle[1] = motor_m2;
+    motor_handle[2] = motor_m3;
+    motor_handle[3] = motor_m4;
+    for (int i = 0; i < PWM_MOTOR_NUM; i++)
+    {
+        motor_state[i] = PWM_MOTOR_STATE_UNKNOWN;
+        motor_compare[i] = 0;
+    }
+    PwmMotor_Benchmark();
+
+    esp_timer_create_args_t timer_args = {
+        .callback = PwmMotor_Vbat_Callback,
+        .name = "pwm_vbat",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &vbat_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(vbat_timer, PWM_MOTOR_VBAT_PERIOD_MS * 1000ULL));
 }
 
@@ -22,26 +22,53 @@ extern "C" {
 
 
 
-// PWM电机时钟频率, 10MHz, 1 tick = 0.1us 
-// PWM motor clock frequency, 10MHz, 1 tick = 0.1us
-#define PWM_MOTOR_TIMER_RESOLUTION_HZ    10000000
+// PWM电机时钟频率, 80MHz, 1 tick = 12.5ns，需能整除MCPWM组时钟(80MHz)，可在编译选项中覆盖
+// PWM motor clock frequency, 80MHz, 1 tick = 12.5ns, must divide the MCPWM group clock (80MHz), may be overridden by a compile definition
+#ifndef PWM_MOTOR_TIMER_RESOLUTION_HZ
+#define PWM_MOTOR_TIMER_RESOLUTION_HZ    80000000
+#endif
 
-// PWM电机控制频率, 25KHz 
-// PWM motor control frequency, 25KHz
+// PWM电机控制频率, 25KHz，可在编译选项中覆盖
+// PWM motor control frequency, 25KHz, may be overridden by a compile definition
+#ifndef PWM_MOTOR_FREQ_HZ
 #define PWM_MOTOR_FREQ_HZ                25000
+#endif
 
-// PWM理论最大值(400) 
-// PWM Theoretical maximum (400)
+// PWM理论最大值(80MHz/25KHz时为3200) 
+// PWM Theoretical maximum (3200 at 80MHz/25KHz)
 #define PWM_MOTOR_DUTY_TICK_MAX          (PWM_MOTOR_TIMER_RESOLUTION_HZ / PWM_MOTOR_FREQ_HZ)
 
-// 电机死区过滤 
-// Motor dead zone filtering
-#define PWM_MOTOR_DEAD_ZONE              (200)
+// 电机死区，只用于默认线性化表 
+// Motor dead zone, only used by the default linearization table
+#define PWM_MOTOR_DEAD_ZONE              (PWM_MOTOR_DUTY_TICK_MAX / 2)
 
-// 电机PWM输入最大值 
-// Maximum motor PWM input value
+// 电机输入最大值，输入为归一化出力，经线性化表换算成PWM 
+// Maximum motor input value, the input is the normalized effort converted to PWM by the linearization table
 #define PWM_MOTOR_MAX_VALUE              (PWM_MOTOR_DUTY_TICK_MAX-PWM_MOTOR_DEAD_ZONE)
 
+// 出力参考满量程，即10MHz/25KHz时的PWM_MOTOR_MAX_VALUE，以出力为单位的参数按此整定，使用时乘以PWM_MOTOR_EFFORT_SCALE 
+// Reference effort full scale, the PWM_MOTOR_MAX_VALUE at 10MHz/25KHz; parameters in effort units are tuned against it and multiplied by PWM_MOTOR_EFFORT_SCALE when used
+#define PWM_MOTOR_EFFORT_REF             (200)
+#define PWM_MOTOR_EFFORT_SCALE           ((float)PWM_MOTOR_MAX_VALUE / PWM_MOTOR_EFFORT_REF)
+
+// 线性化表点数，输入0~PWM_MOTOR_MAX_VALUE等分，第0点为起转PWM，点间线性插值 
+// Number of linearization table points, spread evenly over the input 0~PWM_MOTOR_MAX_VALUE, point 0 is the breakaway PWM, linear interpolation in between
+#define PWM_MOTOR_LUT_SIZE               (9)
+
+// 电池电压补偿：duty按 额定电压/滤波后的电池电压 缩放，使控制环在整个放电过程中看到同样的电机增益。
+// 电压低于PWM_MOTOR_VBAT_MIN视为无效(未采样或USB供电)，不做补偿
+// Battery voltage compensation: the duty is scaled by nominal voltage / filtered battery voltage so the control loops see the same motor gain
+// over the whole discharge. Voltages below PWM_MOTOR_VBAT_MIN are invalid (not sampled yet or USB powered) and not compensated
+#define PWM_MOTOR_VBAT_COMP              (1)
+#define PWM_MOTOR_VBAT_NOMINAL           (7.4f)
+#define PWM_MOTOR_VBAT_MIN               (6.0f)
+#define PWM_MOTOR_VBAT_SCALE_MIN         (0.8f)
+#define PWM_MOTOR_VBAT_SCALE_MAX         (1.3f)
+// 补偿系数更新周期和电压滤波时间常数，单位：ms
+// Compensation update period and voltage filter time constant, unit: ms
+#define PWM_MOTOR_VBAT_PERIOD_MS         (10)
+#define PWM_MOTOR_VBAT_TAU_MS            (500)
+
 // 电机定时器组ID号 
 // Motor timer group ID
 #define PWM_MOTOR_TIMER_GROUP_ID_M1      (0)
@@ -49,6 +76,10 @@ extern "C" {
 #define PWM_MOTOR_TIMER_GROUP_ID_M3      (0)
 #define PWM_MOTOR_TIMER_GROUP_ID_M4      (1)
 
+// 定时器同步引脚，两个MCPWM组都从该引脚取同步信号(内部回环)，初始化时输出一个脉冲使四路定时器同时清零，需为空闲引脚
+// Timer sync pin, both MCPWM groups take the sync signal from it (internal loop back), a pulse at init clears all four timers together, must be a free pin
+#define PWM_MOTOR_SYNC_GPIO              21
+
 
 // 电机ID编号 
 // Motor ID number
@@ -60,6 +91,14 @@ typedef enum _motor_id {
     MOTOR_ID_M4 = 4
 } motor_id_t;
 
+// 电机转向，线性化表按转向分开 
+// Motor direction, the linearization table is split by direction
+typedef enum _pwm_motor_dir {
+    PWM_MOTOR_DIR_FORWARD = 0,
+    PWM_MOTOR_DIR_REVERSE = 1,
+    PWM_MOTOR_DIR_MAX
+} pwm_motor_dir_t;
+
 // 电机停止模式 
 // Motor stop mode
 typedef enum _stop_mode{
@@ -67,11 +106,35 @@ typedef enum _stop_mode{
     STOP_BRAKE = 1
 } stop_mode_t;
 
+// 电机电流衰减方式，即每个PWM周期关断部分H桥的状态。FAST：驱动/滑行；SLOW：驱动/刹车，转速与duty接近线性，降速时主动制动；
+// MIXED：驱动/刹车/滑行，关断部分刹车和滑行各占一半
+// Motor current decay mode, i.e. the H-bridge state in the off part of each PWM period. FAST: drive / coast; SLOW: drive / brake,
+// speed close to linear in duty and active braking when slowing down; MIXED: drive / brake / coast, the off part is half brake and half coast
+typedef enum _pwm_motor_decay {
+    PWM_MOTOR_DECAY_FAST = 0,
+    PWM_MOTOR_DECAY_SLOW,
+    PWM_MOTOR_DECAY_MIXED,
+    PWM_MOTOR_DECAY_MAX
+} pwm_motor_decay_t;
+
+// 上电默认衰减方式。每种衰减方式的转速-duty关系不同，线性化表和前馈按衰减方式各存一套，分别标定
+// Decay mode at power on. The speed-duty relation differs per decay mode, the linearization tables and the feed-forward are kept
+// and calibrated separately for each mode
+#define PWM_MOTOR_DECAY_DEFAULT          PWM_MOTOR_DECAY_FAST
+
 
 void PwmMotor_Init(void);
 void PwmMotor_Set_Speed_All(int speed_1, int speed_2, int speed_3, int speed_4);
 void PwmMotor_Set_Speed(motor_id_t motor_id, int speed);
 void PwmMotor_Stop(motor_id_t motor_id, bool brake);
+void PwmMotor_Set_Duty_All(int duty_1, int duty_2, int duty_3, int duty_4);
+void PwmMotor_Set_Lut(pwm_motor_decay_t decay, motor_id_t motor_id, pwm_motor_dir_t dir, const uint16_t *duty);
+void PwmMotor_Get_Lut(pwm_motor_decay_t decay, motor_id_t motor_id, pwm_motor_dir_t dir, uint16_t *duty);
+void PwmMotor_Reset_Lut(void);
+void PwmMotor_Set_Vbat_Compensation(bool enable);
+float PwmMotor_Get_Vbat_Scale(void);
+void PwmMotor_Set_Decay(pwm_motor_decay_t decay);
+pwm_motor_decay_t PwmMotor_Get_Decay(void);
 
 
 #ifdef __cplusplus
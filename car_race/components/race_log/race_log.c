@@ -0,0 +1,241 @@
+#include "race_log.h"
+
+#include "stdio.h"
+#include "stdarg.h"
+#include "stdbool.h"
+#include "stdatomic.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+
+
+static const char *TAG = "RACE_LOG";
+
+#define RACE_LOG_QUEUE_MASK          (RACE_LOG_QUEUE_LEN - 1)
+_Static_assert(RACE_LOG_QUEUE_LEN >= 2 && (RACE_LOG_QUEUE_LEN & (RACE_LOG_QUEUE_LEN - 1)) == 0, "RACE_LOG_QUEUE_LEN must be a power of 2");
+
+
+// 日志参数，类型在输出时根据格式字符串确定
+// Log argument, the type is determined from the format string when printing
+typedef union _race_log_arg {
+    int64_t i;
+    double f;
+    const void *p;
+} race_log_arg_t;
+
+// 日志记录，seq用于无锁环形缓冲区的槽位同步
+// Log record, seq synchronizes the slot of the lock-free ring buffer
+typedef struct _race_log_record {
+    atomic_uint seq;
+    esp_log_level_t level;
+    uint8_t argc;
+    int64_t time;
+    const char *tag;
+    const char *format;
+    race_log_arg_t args[RACE_LOG_MAX_ARGS];
+} race_log_record_t;
+
+static race_log_record_t race_log_ring[RACE_LOG_QUEUE_LEN];
+static atomic_uint race_log_head = 0;
+static uint32_t race_log_tail = 0;
+static atomic_uint race_log_dropped = 0;
+static bool race_log_ready = false;
+
+
+// 跳过一个格式说明的标志、宽度、精度，返回转换字符的位置，long_long表示是否有ll修饰
+// Skip the flags, width and precision of a conversion spec, return the position of the conversion char, long_long tells whether it has the ll modifier
+static const char *RaceLog_Parse_Spec(const char *p, bool *long_long)
+{
+    int l_count = 0;
+    while (*p && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '.'))
+    {
+        p++;
+    }
+    while (*p == 'l' || *p == 'h' || *p == 'z' || *p == 'j' || *p == 't')
+    {
+        if (*p == 'l') l_count++;
+        p++;
+    }
+    *long_long = (l_count >= 2);
+    return p;
+}
+
+// 写一条延迟日志，缓冲区满时丢弃并计数
+// Write a deferred log, dropped and counted when the buffer is full
+void RaceLog_Write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    if (!race_log_ready) return;
+
+    // 抢占一个空槽位
+    // Claim a free slot
+    race_log_record_t *record = NULL;
+    unsigned int pos = atomic_load_explicit(&race_log_head, memory_order_relaxed);
+    while (1)
+    {
+        record = &race_log_ring[pos & RACE_LOG_QUEUE_MASK];
+        unsigned int seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&race_log_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        }
+        else if (diff < 0)
+        {
+            atomic_fetch_add_explicit(&race_log_dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&race_log_head, memory_order_relaxed);
+        }
+    }
+
+    record->time = esp_timer_get_time();
+    record->level = level;
+    record->tag = tag;
+    record->format = format;
+    record->argc = 0;
+
+    va_list ap;
+    va_start(ap, format);
+    for (const char *p = format; *p && record->argc < RACE_LOG_MAX_ARGS; p++)
+    {
+        if (*p != '%') continue;
+        p++;
+        if (*p == '%') continue;
+        bool long_long = false;
+        p = RaceLog_Parse_Spec(p, &long_long);
+        race_log_arg_t *arg = &record->args[record->argc++];
+        switch (*p)
+        {
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            arg->f = va_arg(ap, double);
+            break;
+        case 's': case 'p':
+            arg->p = va_arg(ap, const void *);
+            break;
+        case '\0':
+            record->argc--;
+            p--;
+            break;
+        default:
+            arg->i = long_long ? va_arg(ap, long long) : va_arg(ap, int);
+            break;
+        }
+    }
+    va_end(ap);
+
+    atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+}
+
+// 按记录的格式字符串和参数格式化一条日志
+// Format one log from the recorded format and arguments
+static void RaceLog_Format(const race_log_record_t *record, char *line, int size)
+{
+    int len = 0;
+    int argi = 0;
+    const char *p = record->format;
+    while (*p && len < size - 1)
+    {
+        if (*p != '%' || p[1] == '%')
+        {
+            line[len++] = *p;
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+
+        bool long_long = false;
+        const char *end = RaceLog_Parse_Spec(p + 1, &long_long);
+        if (*end == '\0' || argi >= record->argc) break;
+
+        char spec[16] = {0};
+        int spec_len = (int)(end - p + 1);
+        if (spec_len >= (int)sizeof(spec)) spec_len = sizeof(spec) - 1;
+        for (int i = 0; i < spec_len; i++) spec[i] = p[i];
+
+        const race_log_arg_t *arg = &record->args[argi++];
+        int n = 0;
+        switch (*end)
+        {
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            n = snprintf(line + len, size - len, spec, arg->f);
+            break;
+        case 's':
+            n = snprintf(line + len, size - len, spec, arg->p ? (const char *)arg->p : "(null)");
+            break;
+        case 'p':
+            n = snprintf(line + len, size - len, spec, arg->p);
+            break;
+        default:
+            if (long_long) n = snprintf(line + len, size - len, spec, (long long)arg->i);
+            else n = snprintf(line + len, size - len, spec, (int)arg->i);
+            break;
+        }
+        if (n > 0) len += n;
+        if (len > size - 1) len = size - 1;
+        p = end + 1;
+    }
+    line[len] = '\0';
+}
+
+// 日志输出任务，取出记录格式化后按原始时间戳打印
+// Log output task, takes the records out, formats and prints them with the original timestamps
+static void RaceLog_Task(void *arg)
+{
+    static char line[RACE_LOG_LINE_MAX];
+    uint32_t reported_dropped = 0;
+
+    ESP_LOGI(TAG, "Start RaceLog_Task with core:%d", xPortGetCoreID());
+    while (1)
+    {
+        race_log_record_t *record = &race_log_ring[race_log_tail & RACE_LOG_QUEUE_MASK];
+        unsigned int seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        if ((int)(seq - (race_log_tail + 1)) < 0)
+        {
+            uint32_t dropped = atomic_load_explicit(&race_log_dropped, memory_order_relaxed);
+            if (dropped != reported_dropped)
+            {
+                ESP_LOGW(TAG, "dropped %u records", (unsigned int)(dropped - reported_dropped));
+                reported_dropped = dropped;
+            }
+            vTaskDelay(pdMS_TO_TICKS(RACE_LOG_DRAIN_MS));
+            continue;
+        }
+
+        RaceLog_Format(record, line, sizeof(line));
+        uint32_t time_ms = (uint32_t)(record->time / 1000);
+        const char *tag = record->tag;
+        esp_log_level_t level = record->level;
+        atomic_store_explicit(&record->seq, race_log_tail + RACE_LOG_QUEUE_LEN, memory_order_release);
+        race_log_tail++;
+
+        if (level == ESP_LOG_ERROR) esp_log_write(level, tag, LOG_FORMAT(E, "%s"), time_ms, tag, line);
+        else if (level == ESP_LOG_WARN) esp_log_write(level, tag, LOG_FORMAT(W, "%s"), time_ms, tag, line);
+        else esp_log_write(level, tag, LOG_FORMAT(I, "%s"), time_ms, tag, line);
+    }
+
+    vTaskDelete(NULL);
+}
+
+// 读取因缓冲区满而丢弃的日志条数
+// Read the number of logs dropped because the buffer was full
+uint32_t RaceLog_Get_Dropped(void)
+{
+    return atomic_load_explicit(&race_log_dropped, memory_order_relaxed);
+}
+
+// 初始化延迟日志
+// Initialize the deferred log
+void RaceLog_Init(void)
+{
+    for (int i = 0; i < RACE_LOG_QUEUE_LEN; i++)
+    {
+        atomic_init(&race_log_ring[i].seq, i);
+    }
+    race_log_ready = true;
+
+    xTaskCreatePinnedToCore(RaceLog_Task, "RaceLog_Task", 4 * 1024, NULL, RACE_LOG_TASK_PRIO, NULL, RACE_LOG_TASK_CORE);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "esp_log.h"
+
+// 日志记录环形缓冲区长度，必须是2的幂
+// Length of the log record ring buffer, must be a power of 2
+#define RACE_LOG_QUEUE_LEN           (64)
+
+// 每条日志最多记录的参数个数
+// Maximum number of arguments recorded per log
+#define RACE_LOG_MAX_ARGS            (6)
+
+// 格式化后单条日志的最大长度
+// Maximum length of one formatted log line
+#define RACE_LOG_LINE_MAX            (160)
+
+// 日志输出任务的核心、优先级和空闲时的轮询周期(ms)
+// Core, priority and idle polling period (ms) of the log output task
+#define RACE_LOG_TASK_CORE           (1)
+#define RACE_LOG_TASK_PRIO           (1)
+#define RACE_LOG_DRAIN_MS            (20)
+
+
+// 延迟日志：控制路径上只记录格式字符串指针、原始参数和时间戳，由低优先级任务格式化输出。
+// 格式字符串和%s参数必须是常量字符串。
+// Deferred log: the control path only records the format pointer, raw arguments and timestamp, a low priority task formats and prints them.
+// The format and %s arguments must be constant strings.
+#define RACE_LOGI(tag, format, ...)  RaceLog_Write(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define RACE_LOGW(tag, format, ...)  RaceLog_Write(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+
+
+void RaceLog_Init(void);
+void RaceLog_Write(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+uint32_t RaceLog_Get_Dropped(void);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,619 @@
+#include "track.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "math.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "car_motion.h"
+#include "encoder.h"
+#include "race_log.h"
+
+
+static const char *TAG = "TRACK";
+
+// 一个编码器脉冲对应的路程，单位：m
+// Distance of one encoder pulse, unit: m
+#define TRACK_PULSE_TO_M             (MOTOR_WHEEL_CIRCLE / MOTOR_ENCODER_CIRCLE / 1000.0f)
+
+
+// 赛道段运动指令
+// Track segment motion command
+typedef struct _track_cmd {
+    float line_v;
+    float angular_v;
+} track_cmd_t;
+
+static const track_segment_t *track_table = NULL;
+static int track_count = 0;
+static int track_index = -1;
+static track_state_t track_state = TRACK_STATE_IDLE;
+
+// 当前段已行驶距离，单位：编码器平均脉冲数
+// Distance travelled in the current segment, unit: average encoder pulses
+static int track_distance = 0;
+
+// 当前段起点的编码器平均脉冲数，段切换时距离基准滚动而不清零PCNT
+// Average encoder pulses at the start of the current segment, the distance reference rolls over on handoff instead of clearing the PCNT units
+static int seg_start_count = 0;
+
+// 当前段起点的里程计读数
+// Odometry reading at the start of the current segment
+static car_odom_t seg_start_odom = {0};
+static car_odom_t track_odom = {0};
+
+// 当前段开始时间和整圈起止时间，单位：us
+// Start time of the current segment and start/end time of the lap, unit: us
+static int64_t seg_start_time = 0;
+static int64_t lap_start_time = 0;
+static int64_t lap_end_time = 0;
+
+// 预取的下一段运动指令，段切换时直接下发，不再多等一个轮询周期
+// Prefetched motion command of the next segment, issued directly on handoff without waiting for another polling period
+static track_cmd_t next_cmd = {0};
+static bool next_cmd_valid = false;
+
+// 速度过渡：从blend_from线性过渡到blend_to
+// Speed blending: ramp linearly from blend_from to blend_to
+static track_cmd_t blend_from = {0};
+static track_cmd_t blend_to = {0};
+static int64_t blend_time = 0;
+static bool blending = false;
+
+// 距离段的速度规划
+// Motion profile of the distance segment
+static motion_profile_t profile = {0};
+static int64_t profile_time = 0;
+static bool profiling = false;
+
+// 当前实测车速
+// Measured chassis speed
+static car_motion_t track_speed = {0};
+
+// 学习得到的制动距离系数，单位：s^2/m
+// Learned braking distance coefficient, unit: s^2/m
+static float brake_coef = TRACK_BRAKE_COEF;
+
+// 距离段结束事件：编码器中断在接近阈值时通知比赛任务，之后每个系统节拍轮询一次直到真正到达阈值
+// Distance segment end event: the encoder interrupt notifies the race task when the threshold is near, then it is polled every tick until reached
+static TaskHandle_t track_task = NULL;
+static bool segment_event = false;
+static bool armed = false;
+static bool armed_near = false;
+static bool approaching = false;
+static int armed_threshold = 0;
+
+// 轮询周期由esp_timer周期定时器产生，不随循环体执行时间漂移
+// The polling period comes from a periodic esp_timer and does not drift with the loop body execution time
+static esp_timer_handle_t period_timer = NULL;
+static uint32_t track_period_ms = TRACK_PERIOD_MS;
+static volatile uint32_t tick_count = 0;
+static uint32_t tick_seen = 0;
+static uint32_t overrun_count = 0;
+
+// 每段的分段计时和结束误差记录，距离单位：编码器平均脉冲数，时间单位：us
+// Per-segment split time and exit error record, distance unit: average encoder pulses, time unit: us
+typedef struct _track_result {
+    int target;
+    int trigger;        // 触发结束时的距离 Distance when the exit was triggered
+    int achieved;       // 过渡完成后实际停下/交接的距离 Distance actually reached after the transition
+    float speed;        // 触发结束时的车速，单位：m/s Speed when the exit was triggered, unit: m/s
+    float peak_speed;   // 本段最高车速，单位：m/s Peak speed in this segment, unit: m/s
+    float odom;         // 本段里程计路程，单位：m Odometry distance of this segment, unit: m
+    int64_t enter_time; // 进入本段（停车稳定之后）的时间 Entry time, after the settle delay
+    int64_t exit_time;  // 触发结束的时间 Time the exit was triggered
+    int64_t settle_time;// 进入本段前停车稳定花费的时间 Time spent stopping and settling before this segment
+} track_result_t;
+
+static track_result_t track_result[TRACK_MAX_SEGMENTS] = {0};
+
+
+// 预取第index段的运动指令
+// Prefetch the motion command of segment index
+static void Track_Prefetch(int index)
+{
+    if (index >= track_count)
+    {
+        next_cmd_valid = false;
+        return;
+    }
+    next_cmd.line_v = track_table[index].line_v;
+    next_cmd.angular_v = track_table[index].angular_v;
+    next_cmd_valid = true;
+}
+
+// 预测本段结束时实际到达的距离：当前距离 + 检测延迟内行驶的距离 + 停车时的制动距离
+// Predict the distance actually reached when ending this segment: current distance + distance covered during the detection latency + braking distance if stopping
+static float Track_Predict_Distance(void)
+{
+    float v = track_speed.Vx > 0 ? track_speed.Vx : 0;
+    float predict = 0;
+    // 没有中断事件时，下一次检测在一个周期后，取半个周期使平均误差最小
+    // Without the interrupt event the next check is one period away, half a period minimises the average error
+    if (!armed) predict += v * (track_period_ms / 2000.0f);
+    bool stopping = (track_index + 1 >= track_count) || (track_table[track_index + 1].trans == TRACK_TRANS_STOP);
+    if (stopping) predict += brake_coef * v * v;
+    return track_distance + predict / TRACK_PULSE_TO_M;
+}
+
+// 本段打滑轮子多转出的脉冲数，平均编码器计数要扣除这部分才是实际走过的距离
+// Pulses turned by slipping wheels in this segment, to be taken out of the average encoder count for the real distance
+static int Track_Slip_Pulses(void)
+{
+    return (int)((track_odom.slip - seg_start_odom.slip) / TRACK_PULSE_TO_M);
+}
+
+// 按当前制动距离设置编码器中断阈值，阈值变化不大时不重复设置；阈值还远、编码器未设置观察点时每个周期重试
+// Arm the encoder interrupt threshold with the current braking distance, skipped when the threshold barely moves;
+// retried every period while the threshold is still too far for the encoder to place its watch points
+static void Track_Arm(const track_segment_t *seg)
+{
+    float v = track_speed.Vx > 0 ? track_speed.Vx : 0;
+    bool stopping = (track_index + 1 >= track_count) || (track_table[track_index + 1].trans == TRACK_TRANS_STOP);
+    int lead = stopping ? (int)(brake_coef * v * v / TRACK_PULSE_TO_M) : 0;
+    int threshold = seg_start_count + seg->distance + Track_Slip_Pulses() - lead;
+    if (armed && armed_near && abs(threshold - armed_threshold) < TRACK_ARM_HYSTERESIS) return;
+
+    armed_near = Encoder_Arm_Average(threshold, track_task, TRACK_NOTIFY_SEGMENT_END);
+    armed_threshold = threshold;
+    armed = true;
+}
+
+// 取消编码器中断阈值，之后到达的旧事件在Track_Wait里按阈值校验后丢弃
+// Disarm the encoder interrupt threshold, stale events arriving later are checked against the threshold and dropped in Track_Wait
+static void Track_Disarm(void)
+{
+    if (armed) Encoder_Disarm_Average();
+    armed = false;
+    armed_near = false;
+    approaching = false;
+    segment_event = false;
+}
+
+// 周期定时器回调，通知比赛任务进入下一个周期
+// Period timer callback, notifies the race task of the next period
+static void Track_Period_Callback(void *arg)
+{
+    tick_count++;
+    if (track_task != NULL) xTaskNotify(track_task, TRACK_NOTIFY_TICK, eSetBits);
+}
+
+// 创建并(重新)启动周期定时器
+// Create and (re)start the period timer
+static void Track_Start_Timer(void)
+{
+    if (period_timer == NULL)
+    {
+        esp_timer_create_args_t timer_args = {
+            .callback = Track_Period_Callback,
+            .name = "track_period",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &period_timer));
+    }
+    esp_timer_stop(period_timer);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(period_timer, track_period_ms * 1000ULL));
+}
+
+// 判断当前段是否满足结束条件
+// Check whether the current segment meets its exit condition
+static bool Track_Segment_Done(const track_segment_t *seg)
+{
+    int64_t elapsed = esp_timer_get_time() - seg_start_time;
+    float target = fabsf(seg->angle) * (float)M_PI / 180.0f;
+
+    switch (seg->exit)
+    {
+    case TRACK_EXIT_DISTANCE:
+        if (segment_event) return true;
+        return Track_Predict_Distance() >= seg->distance;
+    case TRACK_EXIT_TIME:
+        return elapsed >= (int64_t)seg->time_ms * 1000;
+    case TRACK_EXIT_HEADING:
+    {
+        // 补偿半个轮询周期的检测延迟
+        // Compensate half a polling period of detection latency
+        float turned = track_odom.heading - seg_start_odom.heading + track_speed.Wz * (track_period_ms / 2000.0f);
+        if (seg->angle < 0) turned = -turned;
+        if (turned >= target) return true;
+        break;
+    }
+    case TRACK_EXIT_ARC:
+    {
+        // 弧长 = 半径 * 角度，半径 = 线速度 / 角速度
+        // Arc length = radius * angle, radius = linear speed / angular speed
+        if (seg->angular_v == 0) return true;
+        float arc = target * fabsf(seg->line_v / seg->angular_v);
+        if (track_odom.distance - seg_start_odom.distance >= arc) return true;
+        break;
+    }
+    case TRACK_EXIT_POSITION:
+        if (Motion_Move_Done()) return true;
+        break;
+    default:
+        return true;
+    }
+
+    if (seg->timeout_ms > 0 && elapsed >= (int64_t)seg->timeout_ms * 1000)
+    {
+        RACE_LOGW(TAG, "%s timeout", seg->name);
+        return true;
+    }
+    return false;
+}
+
+// 记录上一段过渡完成后的实际距离，并根据停车误差修正制动距离系数
+// Record the distance actually reached after the previous transition, and correct the braking coefficient from the stop error
+static void Track_Record_Achieved(bool stopped)
+{
+    if (track_index < 0 || track_index >= track_count) return;
+    const track_segment_t *seg = &track_table[track_index];
+    track_result_t *result = &track_result[track_index];
+    result->achieved = Encoder_Get_Count_Average() - seg_start_count - Track_Slip_Pulses();
+
+    if (stopped && seg->exit == TRACK_EXIT_DISTANCE && result->speed > 0.1f)
+    {
+        float error = (result->achieved - result->target) * TRACK_PULSE_TO_M;
+        brake_coef += TRACK_BRAKE_LEARN * error / (result->speed * result->speed);
+        if (brake_coef < 0) brake_coef = 0;
+        if (brake_coef > 1.0f) brake_coef = 1.0f;
+    }
+}
+
+// 进入第index段，index超出赛道段数时结束比赛
+// Enter segment index, the race finishes when index exceeds the number of segments
+static void Track_Enter(int index)
+{
+    if (index >= track_count)
+    {
+        Motion_Stop(false);
+        Track_Disarm();
+        PwmMotor_Set_Decay(PWM_MOTOR_DECAY_DEFAULT);
+        if (lap_end_time == 0) lap_end_time = esp_timer_get_time();
+        Track_Record_Achieved(false);
+        track_index = track_count;
+        track_state = TRACK_STATE_DONE;
+        return;
+    }
+
+    const track_segment_t *seg = &track_table[index];
+    // 上一段已经预取了本段指令，这里兜底处理第一段
+    // The previous segment has prefetched this command, the fallback is for the first segment
+    if (!next_cmd_valid) Track_Prefetch(index);
+    track_cmd_t cmd = next_cmd;
+
+    blending = false;
+    if (index > 0 && seg->trans == TRACK_TRANS_BLEND)
+    {
+        // 以当前实测速度为起点，避免指令突变
+        // Start from the measured speed to avoid a step in the command
+        car_motion_t car = {0};
+        Motion_Get_Speed(&car);
+        blend_from.line_v = car.Vx;
+        blend_from.angular_v = car.Wz;
+        blend_to = cmd;
+        blend_time = (seg->blend_ms > 0 ? seg->blend_ms : TRACK_BLEND_MS) * 1000LL;
+        blending = true;
+        cmd = blend_from;
+        Track_Record_Achieved(false);
+    }
+    else if (index > 0)
+    {
+        int64_t stop_time = esp_timer_get_time();
+        Motion_Stop(false);
+        if (seg->settle_ms > 0) vTaskDelay(pdMS_TO_TICKS(seg->settle_ms));
+        // 停车稳定是有意的等待，期间经过的周期不计为超时
+        // The settle is a deliberate wait, the periods passing during it are not counted as overruns
+        tick_seen = tick_count;
+        Track_Record_Achieved(true);
+        track_result[index].settle_time = esp_timer_get_time() - stop_time;
+    }
+
+    if (seg->type == TRACK_SEG_RUSH && lap_end_time == 0)
+    {
+        lap_end_time = esp_timer_get_time();
+    }
+
+    track_index = index;
+    Track_Prefetch(index + 1);
+
+    // 衰减方式在电机任务下一次输出时切换，本段的减速由它决定是主动制动还是滑行
+    // The decay mode switches on the next output of the motor task, it decides whether this segment slows down by braking or by coasting
+    PwmMotor_Set_Decay(seg->decay);
+
+    // 直线按速度规划加速，并以下一段需要的速度到达终点；平滑过渡时规划从实测线速度起步，角速度仍按过渡时间插值
+    // Accelerate along the motion profile and arrive with the speed the next segment wants; when blending the profile starts from
+    // the measured linear speed and the angular speed is still interpolated over the blend time
+    profiling = false;
+    if (seg->accel > 0 && seg->exit == TRACK_EXIT_DISTANCE)
+    {
+        float v_exit = 0;
+        if (next_cmd_valid && track_table[index + 1].trans == TRACK_TRANS_BLEND) v_exit = next_cmd.line_v;
+        Motion_Profile_Init(&profile, seg->distance * TRACK_PULSE_TO_M, seg->line_v,
+                            seg->accel, seg->jerk, blending ? blend_from.line_v : 0, v_exit);
+        cmd.line_v = profile.vel;
+        profiling = true;
+    }
+
+    // 位置段由电机任务里的位置环走完全程并停在终点，到位时通知比赛任务
+    // Position segments are run by the position loop in the motor task, which stops on the end point and notifies the race task on arrival
+    if (seg->exit == TRACK_EXIT_POSITION)
+    {
+        blending = false;
+        Motion_Move(seg->distance * TRACK_PULSE_TO_M, 0, 0, seg->line_v, seg->accel > 0 ? seg->accel : TRACK_MOVE_ACCEL,
+                    track_task, TRACK_NOTIFY_SEGMENT_END);
+    }
+    else
+    {
+        Motion_Ctrl(cmd.line_v, 0, cmd.angular_v);
+    }
+    seg_start_time = esp_timer_get_time();
+    track_result[index].enter_time = seg_start_time;
+    profile_time = seg_start_time;
+    seg_start_count = Encoder_Get_Count_Average();
+    track_distance = 0;
+    Motion_Odom_Update();
+    Motion_Get_Odom(&seg_start_odom);
+    track_odom = seg_start_odom;
+
+    Track_Disarm();
+    if (seg->exit == TRACK_EXIT_DISTANCE) Track_Arm(seg);
+}
+
+// 过渡期间按时间线性插值下发速度指令
+// Issue the linearly interpolated speed command while blending
+static void Track_Blend(void)
+{
+    int64_t elapsed = esp_timer_get_time() - seg_start_time;
+    if (elapsed >= blend_time)
+    {
+        Motion_Ctrl(blend_to.line_v, 0, blend_to.angular_v);
+        blending = false;
+        return;
+    }
+    float k = (float)elapsed / (float)blend_time;
+    Motion_Ctrl(blend_from.line_v + (blend_to.line_v - blend_from.line_v) * k, 0,
+                blend_from.angular_v + (blend_to.angular_v - blend_from.angular_v) * k);
+}
+
+// 按速度规划下发速度指令，过渡期间角速度按时间线性插值
+// Issue the speed command of the motion profile, the angular speed is linearly interpolated while blending
+static void Track_Profile(const track_segment_t *seg)
+{
+    int64_t now = esp_timer_get_time();
+    float dt = (now - profile_time) / 1000000.0f;
+    profile_time = now;
+    float v = Motion_Profile_Update(&profile, dt, track_distance * TRACK_PULSE_TO_M);
+
+    float w = seg->angular_v;
+    if (blending)
+    {
+        int64_t elapsed = now - seg_start_time;
+        if (elapsed >= blend_time) blending = false;
+        else w = blend_from.angular_v + (blend_to.angular_v - blend_from.angular_v) * ((float)elapsed / (float)blend_time);
+    }
+    Motion_Ctrl(v, 0, w);
+}
+
+// 设置轮询周期，单位：ms
+// Set the polling period, unit: ms
+void Track_Set_Period(uint32_t period_ms)
+{
+    if (period_ms == 0) return;
+    track_period_ms = period_ms;
+    if (period_timer != NULL) Track_Start_Timer();
+}
+
+// 载入赛道段表
+// Load the track segment table
+void Track_Init(const track_segment_t *segments, int count)
+{
+    if (count > TRACK_MAX_SEGMENTS)
+    {
+        ESP_LOGW(TAG, "Too many segments:%d, only run the first %d", count, TRACK_MAX_SEGMENTS);
+        count = TRACK_MAX_SEGMENTS;
+    }
+    track_table = segments;
+    track_count = count;
+    track_index = -1;
+    track_distance = 0;
+    lap_start_time = 0;
+    lap_end_time = 0;
+    next_cmd_valid = false;
+    blending = false;
+    profiling = false;
+    for (int i = 0; i < TRACK_MAX_SEGMENTS; i++)
+    {
+        track_result[i] = (track_result_t){0};
+    }
+    track_state = TRACK_STATE_IDLE;
+}
+
+// 发车，从第一段开始执行
+// Start the race from the first segment
+void Track_Start(void)
+{
+    if (track_table == NULL || track_count <= 0) return;
+    ESP_LOGI(TAG, "Start track with %d segments", track_count);
+    lap_start_time = esp_timer_get_time();
+    lap_end_time = 0;
+    track_task = xTaskGetCurrentTaskHandle();
+    overrun_count = 0;
+    tick_seen = tick_count;
+    Track_Start_Timer();
+    next_cmd_valid = false;
+    track_state = TRACK_STATE_RUNNING;
+    Encoder_Clear_Count_All();
+    Motion_Odom_Reset();
+    Track_Enter(0);
+}
+
+// 每个轮询周期调用一次，检查当前段是否结束并切换到下一段，比赛进行中返回true
+// Called once per polling period, checks whether the current segment is finished and switches to the next one, returns true while racing
+bool Track_Update(void)
+{
+    if (track_state != TRACK_STATE_RUNNING) return false;
+
+    const track_segment_t *seg = &track_table[track_index];
+    Motion_Odom_Update();
+    Motion_Get_Odom(&track_odom);
+    track_distance = Encoder_Get_Count_Average() - seg_start_count - Track_Slip_Pulses();
+    Motion_Get_Speed(&track_speed);
+    if (track_speed.Vx > track_result[track_index].peak_speed) track_result[track_index].peak_speed = track_speed.Vx;
+    if (seg->exit == TRACK_EXIT_DISTANCE && !segment_event) Track_Arm(seg);
+    if (!Track_Segment_Done(seg))
+    {
+        if (profiling) Track_Profile(seg);
+        else if (blending) Track_Blend();
+        return true;
+    }
+
+    bool has_distance = (seg->exit == TRACK_EXIT_DISTANCE || seg->exit == TRACK_EXIT_POSITION);
+    track_result[track_index].target = has_distance ? seg->distance : 0;
+    track_result[track_index].trigger = track_distance;
+    track_result[track_index].speed = track_speed.Vx;
+    track_result[track_index].odom = track_odom.distance - seg_start_odom.distance;
+    track_result[track_index].exit_time = esp_timer_get_time();
+
+    if (track_index + 1 < track_count)
+    {
+        RACE_LOGI(TAG, "%s -> %s", seg->name, track_table[track_index + 1].name);
+    }
+    else
+    {
+        RACE_LOGI(TAG, "%s -> finish", seg->name);
+    }
+    Track_Enter(track_index + 1);
+    return track_state == TRACK_STATE_RUNNING;
+}
+
+// 阻塞等待下一个轮询周期，距离段结束事件或位置段到位通知到达时提前返回；比赛中错过的周期计为超时
+// Block until the next polling period, returns early when the distance segment end event or the position segment arrival arrives; periods missed while racing are counted as overruns
+void Track_Wait(void)
+{
+    if (period_timer == NULL)
+    {
+        vTaskDelay(pdMS_TO_TICKS(track_period_ms));
+        return;
+    }
+
+    // 收到接近通知后每个系统节拍轮询一次平均脉冲数，真正到达阈值或下一个周期到来时返回；
+    // 阈值只按当前值判断，上一段遗留的通知最多多轮询几次，不会误触发
+    // After the approach notification the average count is polled every system tick, returns once the threshold is really reached or the
+    // next period arrives; only the current threshold is checked, a notification left over from the previous segment just costs a few polls
+    uint32_t bits = 0;
+    bool reached = false;
+    while ((bits & TRACK_NOTIFY_TICK) == 0 && !reached)
+    {
+        uint32_t got = 0;
+        xTaskNotifyWait(0, TRACK_NOTIFY_TICK | TRACK_NOTIFY_SEGMENT_END, &got, approaching ? 1 : portMAX_DELAY);
+        bits |= got;
+        // 位置段的到位通知直接返回，由Track_Update按Motion_Move_Done()确认
+        // The arrival notification of a position segment returns at once, Track_Update confirms it with Motion_Move_Done()
+        if ((got & TRACK_NOTIFY_SEGMENT_END) && track_state == TRACK_STATE_RUNNING && track_table[track_index].exit == TRACK_EXIT_POSITION) break;
+        if ((got & TRACK_NOTIFY_SEGMENT_END) && armed) approaching = true;
+        if (approaching && Encoder_Get_Count_Average() >= armed_threshold)
+        {
+            approaching = false;
+            segment_event = true;
+            reached = true;
+        }
+    }
+
+    if (bits & TRACK_NOTIFY_TICK)
+    {
+        uint32_t ticks = tick_count;
+        if (track_state == TRACK_STATE_RUNNING && ticks - tick_seen > 1) overrun_count += ticks - tick_seen - 1;
+        tick_seen = ticks;
+    }
+}
+
+// 强制停车，终止比赛
+// Force stop and abort the race
+void Track_Abort(void)
+{
+    Motion_Stop(true);
+    Track_Disarm();
+    PwmMotor_Set_Decay(PWM_MOTOR_DECAY_DEFAULT);
+    Encoder_Clear_Count_All();
+    Motion_Odom_Reset();
+    seg_start_count = 0;
+    track_distance = 0;
+    blending = false;
+    profiling = false;
+    if (track_state == TRACK_STATE_RUNNING) track_state = TRACK_STATE_ABORT;
+}
+
+// 打印分段计时报告：进入时刻、分段用时、停车稳定用时、路程、最高车速和距离段的结束误差
+// Print the split report: entry time, split time, settle time, distance, peak speed and the exit error of distance segments
+void Track_Report(void)
+{
+    int64_t settle_total = 0;
+
+    ESP_LOGI(TAG, "seg  at(ms)  split(ms)  settle(ms)  dist(mm)  peak(m/s)  exit(m/s)  err(mm)  name");
+    for (int i = 0; i < track_count; i++)
+    {
+        const track_result_t *result = &track_result[i];
+        if (result->enter_time == 0) break;
+
+        char error[12] = "-";
+        if (track_table[i].exit == TRACK_EXIT_DISTANCE || track_table[i].exit == TRACK_EXIT_POSITION)
+        {
+            snprintf(error, sizeof(error), "%.1f", (result->achieved - result->target) * TRACK_PULSE_TO_M * 1000.0f);
+        }
+        int64_t split = (result->exit_time > 0 ? result->exit_time : esp_timer_get_time()) - result->enter_time;
+        ESP_LOGI(TAG, "%3d  %6d  %9d  %10d  %8.0f  %9.3f  %9.3f  %7s  %s", i,
+                 (int)((result->enter_time - lap_start_time) / 1000), (int)(split / 1000), (int)(result->settle_time / 1000),
+                 result->odom * 1000.0f, result->peak_speed, result->speed, error, track_table[i].name);
+        settle_total += result->settle_time;
+    }
+    ESP_LOGI(TAG, "settle total: %d ms, brake coef: %.3f s^2/m, overruns: %u", (int)(settle_total / 1000), brake_coef,
+             (unsigned int)overrun_count);
+}
+
+// 读取执行器状态
+// Read the executor state
+track_state_t Track_Get_State(void)
+{
+    return track_state;
+}
+
+// 读取当前段序号
+// Read the current segment index
+int Track_Get_Index(void)
+{
+    return track_index;
+}
+
+// 读取当前段已行驶距离，单位：编码器平均脉冲数
+// Read the distance travelled in the current segment, unit: average encoder pulses
+int Track_Get_Distance(void)
+{
+    return track_distance;
+}
+
+// 读取学习得到的制动距离系数，单位：s^2/m
+// Read the learned braking distance coefficient, unit: s^2/m
+float Track_Get_Brake_Coef(void)
+{
+    return brake_coef;
+}
+
+// 读取比赛中错过的轮询周期数
+// Read the number of polling periods missed while racing
+uint32_t Track_Get_Overruns(void)
+{
+    return overrun_count;
+}
+
+// 读取整圈用时，未完成时返回0，单位：us
+// Read the lap time, returns 0 if not finished, unit: us
+int64_t Track_Get_Lap_Time(void)
+{
+    if (lap_start_time == 0 || lap_end_time == 0) return 0;
+    return lap_end_time - lap_start_time;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "pwm_motor.h"
+
+// 赛道执行器默认轮询周期，单位：ms
+// Default track executor polling period, unit: ms
+#define TRACK_PERIOD_MS              (10)
+
+// 段间停车后等待车身稳定的时间，单位：ms
+// Time to wait for the chassis to settle after stopping between segments, unit: ms
+#define TRACK_SETTLE_MS              (100)
+
+
+// 段切换时速度从当前值过渡到新指令的默认时间，单位：ms
+// Default time to blend the speed from the current value to the new command on handoff, unit: ms
+#define TRACK_BLEND_MS               (60)
+
+
+// 距离段结束事件和周期定时器的任务通知位
+// Task notification bits of the distance segment end event and the period timer
+#define TRACK_NOTIFY_SEGMENT_END     (1UL << 0)
+#define TRACK_NOTIFY_TICK            (1UL << 1)
+
+// 距离阈值变化超过该值时重新设置编码器阈值，单位：编码器平均脉冲数
+// Re-arm the encoder threshold when it moves by more than this, unit: average encoder pulses
+#define TRACK_ARM_HYSTERESIS         (20)
+
+// 赛道最大段数
+// Maximum number of track segments
+#define TRACK_MAX_SEGMENTS           (32)
+
+// 停车制动距离系数初值，制动距离 = 系数 * v^2，单位：s^2/m
+// Initial braking distance coefficient, braking distance = coefficient * v^2, unit: s^2/m
+#define TRACK_BRAKE_COEF             (0.2f)
+
+// 位置段未设置accel时使用的最大加速度，单位：m/s^2
+// Max acceleration of position segments without accel, unit: m/s^2
+#define TRACK_MOVE_ACCEL             (1.5f)
+
+// 制动距离系数学习率
+// Learning rate of the braking distance coefficient
+#define TRACK_BRAKE_LEARN            (0.5f)
+
+
+// 赛道段类型
+// Track segment type
+typedef enum _track_seg_type {
+    TRACK_SEG_STRAIGHT = 0,     // 直线 Straight
+    TRACK_SEG_TURN,             // 弯道 Turn
+    TRACK_SEG_RUSH,             // 终点冲刺，进入时记录圈速 Final rush, lap time is taken on entry
+} track_seg_type_t;
+
+// 赛道段结束条件
+// Track segment exit condition
+typedef enum _track_exit {
+    TRACK_EXIT_DISTANCE = 0,    // 编码器平均脉冲数达到distance Average encoder pulses reach distance
+    TRACK_EXIT_TIME,            // 运行时间达到time_ms Running time reaches time_ms
+    TRACK_EXIT_HEADING,         // 里程计航向角转过angle Odometry heading has turned by angle
+    TRACK_EXIT_ARC,             // 里程计弧长达到angle对应的弧长 Odometry arc length reaches the arc of angle
+    TRACK_EXIT_POSITION,        // 位置环走完distance并停稳 The position loop has covered distance and settled
+} track_exit_t;
+
+// 进入赛道段的过渡方式
+// Transition mode into a track segment
+typedef enum _track_trans {
+    TRACK_TRANS_STOP = 0,       // 先停车、等待settle_ms再执行 Stop, wait settle_ms, then run
+    TRACK_TRANS_BLEND,          // 不停车，从当前速度过渡到新指令 No stop, blend from the current speed into the new command
+} track_trans_t;
+
+// 赛道段描述
+// Track segment descriptor
+typedef struct _track_segment {
+    const char *name;           // 段名称，用于日志 Segment name, used for logging
+    track_seg_type_t type;
+    track_exit_t exit;
+    int distance;               // 目标距离，单位：编码器平均脉冲数 Target distance, unit: average encoder pulses
+    float angle;                // 目标角度，单位：度，左转为正 Target angle, unit: degree, left turn is positive
+    uint32_t time_ms;           // 目标时间，单位：ms Target time, unit: ms
+    uint32_t timeout_ms;        // 里程计结束条件的超时保护，0表示不限，单位：ms Timeout of odometry exits, 0 means none, unit: ms
+    float line_v;               // 线速度，单位：m/s Linear speed, unit: m/s
+    float angular_v;            // 角速度，单位：rad/s，左转为正 Angular speed, unit: rad/s, left turn is positive
+    float accel;                // 距离段速度规划的最大加速度，0表示恒速，单位：m/s^2 Max acceleration of the distance profile, 0 means constant speed, unit: m/s^2
+    float jerk;                 // 速度规划的最大加加速度，0表示梯形规划，单位：m/s^3 Max jerk of the profile, 0 means trapezoidal, unit: m/s^3
+    track_trans_t trans;        // 进入本段的过渡方式 Transition mode into this segment
+    uint32_t settle_ms;         // TRACK_TRANS_STOP停车稳定时间，单位：ms Settle time of TRACK_TRANS_STOP, unit: ms
+    uint32_t blend_ms;          // TRACK_TRANS_BLEND过渡时间，0表示TRACK_BLEND_MS，单位：ms Blend time of TRACK_TRANS_BLEND, 0 means TRACK_BLEND_MS, unit: ms
+    pwm_motor_decay_t decay;    // 本段电机电流衰减方式，默认FAST Motor current decay mode of this segment, FAST by default
+} track_segment_t;
+
+// 赛道执行器状态
+// Track executor state
+typedef enum _track_state {
+    TRACK_STATE_IDLE = 0,
+    TRACK_STATE_RUNNING,
+    TRACK_STATE_DONE,
+    TRACK_STATE_ABORT,
+} track_state_t;
+
+
+void Track_Init(const track_segment_t *segments, int count);
+void Track_Set_Period(uint32_t period_ms);
+void Track_Start(void);
+bool Track_Update(void);
+void Track_Wait(void);
+void Track_Abort(void);
+void Track_Report(void);
+
+track_state_t Track_Get_State(void);
+int Track_Get_Index(void);
+int Track_Get_Distance(void);
+int64_t Track_Get_Lap_Time(void);
+float Track_Get_Brake_Coef(void);
+uint32_t Track_Get_Overruns(void);
+
+
+#ifdef __cplusplus
+}
+#endif
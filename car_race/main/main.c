@@ -3,15 +3,14 @@
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "nvs_flash.h"
 
 #include "car_motion.h"
+#include "motor.h"
 #include "battery.h"
 #include "key.h"
-#include "encoder.h"
-#include "driver/pulse_cnt.h"
-
-//记录整个赛道时间的
-#include "esp_timer.h"
+#include "track.h"
+#include "race_log.h"
 
 /*
  * =============================================================================
@@ -24,11 +23,15 @@ static const char *TAG = "RACE";
 
 
 // --- 速度标定 (单位: RPM 或你PID控制器的目标单位) ---
-#define SPEED_STRAIGHT_01  0.6 // 顶部大直线的速度
+#define SPEED_STRAIGHT_01  0.9 // 顶部大直线的速度 (速度规划的最高速度)
 #define SPEED_STRAIGHT_02  0.6 // 右侧短直线的速度
 #define SPEED_STRAIGHT_03  0.6 // 底侧短直线的速度
 #define SPEED_STRAIGHT_04  0.6 // 左侧短直线的速度
 
+// --- 直线速度规划 (加速度 m/s^2, 加加速度 m/s^3) ---
+#define ACCEL_STRAIGHT      1.0
+#define JERK_STRAIGHT       5.0
+
 // --- 右转 150 (R 0.65) ---
 #define SPEED_R_150_LINE    0.28 // 线速度 v=w*r 
 #define SPEED_R_150_W       -0.8 // 角速度 
@@ -62,304 +65,189 @@ static const char *TAG = "RACE";
 #define straight_04               2500  //0.5
 #define turn_right_90_B           2500  //r0.35-0.65   (避免宏定义冲突，改名)
 
-extern pcnt_unit_handle_t encoder_unit_m1;
-extern pcnt_unit_handle_t encoder_unit_m2;
-extern pcnt_unit_handle_t encoder_unit_m3;
-extern pcnt_unit_handle_t encoder_unit_m4;
+// --- 弯道结束条件 ---
+// 弯道由编码器里程计积分的航向角判断结束，上面标定的弯道时间只作为超时保护
+#define TURN_EXIT           TRACK_EXIT_HEADING
+#define TURN_TIMEOUT(t)     ((t) * 3 / 2)
+
+// --- 比赛任务配置 ---
+#define RACE_TASK_CORE      0                   // 运行核心
+#define RACE_TASK_PRIO      8                   // 优先级
+#define RACE_TASK_STACK     (6 * 1024)          // 栈大小
+#define RACE_TASK_PERIOD    TRACK_PERIOD_MS     // 控制周期 ms
+
+// --- 段间过渡方式 ---
+// TRACK_TRANS_BLEND: 不停车，速度直接过渡到下一段  TRACK_TRANS_STOP: 每段停车等待稳定
+#define RACE_TRANS          TRACK_TRANS_BLEND
 
+// --- 直线结束条件 ---
+// 段间停车时直线由位置环走完并停在终点，不停车时按编码器距离交接给下一段
+#define STRAIGHT_EXIT       ((RACE_TRANS == TRACK_TRANS_STOP) ? TRACK_EXIT_POSITION : TRACK_EXIT_DISTANCE)
 
-int encoder_count_M1 = 0;
-int encoder_count_M2 = 0;
-int encoder_count_M3 = 0;
-int encoder_count_M4 = 0;
+// --- 电机电流衰减方式 ---
+// 每种方式有自己的线性化表和前馈，需先开机同时按住Key0和Key1做过按方式的标定后才能切换；
+// 标定后可把直线改为PWM_MOTOR_DECAY_SLOW(减速入弯时主动制动)，弯道改为PWM_MOTOR_DECAY_MIXED。冲刺不设置，为快衰减
+#define STRAIGHT_DECAY      PWM_MOTOR_DECAY_FAST
+#define TURN_DECAY          PWM_MOTOR_DECAY_FAST
+
+// --- 终点冲刺 ---
+#define SPEED_RUSH          0.8 // 线速度
+#define RUSH_TIME           250 // ms
 
-double p = 0.1924; //一个脉冲对应的路程(mm)
 /*
  * =============================================================================
- * 2. 抽象函数 
+ * 2. 赛道段表
  * =============================================================================
  *
+ * 每一段赛道用一条描述表示，换赛道或重新标定只需修改这张表
  */
 
-// 控制小车运动 三个参数分别是 线速度 左右平移速度 角速度
-extern void Motion_Ctrl(float V_x, float V_y, float V_z);
+static const track_segment_t race_track[] = {
+    { .name = "第一部分直线",       .type = TRACK_SEG_STRAIGHT, .exit = STRAIGHT_EXIT,
+      .distance = straight_01,     .line_v = SPEED_STRAIGHT_01,
+      .accel = ACCEL_STRAIGHT,     .jerk = JERK_STRAIGHT,    .decay = STRAIGHT_DECAY },
+    { .name = "右上150度弯",        .type = TRACK_SEG_TURN,     .exit = TURN_EXIT,
+      .angle = -150.0f,            .timeout_ms = TURN_TIMEOUT(turn_right_150),
+      .line_v = SPEED_R_150_LINE,  .angular_v = SPEED_R_150_W,    .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .decay = TURN_DECAY },
+    { .name = "右下侧小直线",       .type = TRACK_SEG_STRAIGHT, .exit = STRAIGHT_EXIT,
+      .distance = straight_02,     .line_v = SPEED_STRAIGHT_02,  .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .accel = ACCEL_STRAIGHT,     .jerk = JERK_STRAIGHT,    .decay = STRAIGHT_DECAY },
+    { .name = "右下角右拐九十度",   .type = TRACK_SEG_TURN,     .exit = TURN_EXIT,
+      .angle = -90.0f,             .timeout_ms = TURN_TIMEOUT(turn_right_90),
+      .line_v = SPEED_R_90_LINE,   .angular_v = SPEED_R_90_W,     .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .decay = TURN_DECAY },
+    { .name = "右下左拐60度弯",     .type = TRACK_SEG_TURN,     .exit = TURN_EXIT,
+      .angle = 60.0f,              .timeout_ms = TURN_TIMEOUT(turn_left_60),
+      .line_v = SPEED_L_60_LINE,   .angular_v = SPEED_L_60_W,     .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .decay = TURN_DECAY },
+    { .name = "底侧小直线",         .type = TRACK_SEG_STRAIGHT, .exit = STRAIGHT_EXIT,
+      .distance = straight_03,     .line_v = SPEED_STRAIGHT_03,  .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .accel = ACCEL_STRAIGHT,     .jerk = JERK_STRAIGHT,    .decay = STRAIGHT_DECAY },
+    { .name = "左拐63.97度弯",      .type = TRACK_SEG_TURN,     .exit = TURN_EXIT,
+      .angle = 63.97f,             .timeout_ms = TURN_TIMEOUT(turn_left_63),
+      .line_v = SPEED_L_63_LINE,   .angular_v = SPEED_L_63_W,     .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .decay = TURN_DECAY },
+    { .name = "右拐153.97度弯",     .type = TRACK_SEG_TURN,     .exit = TURN_EXIT,
+      .angle = -153.97f,           .timeout_ms = TURN_TIMEOUT(turn_right_153),
+      .line_v = SPEED_R_153_LINE,  .angular_v = SPEED_R_153_W,    .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .decay = TURN_DECAY },
+    { .name = "左侧小直线",         .type = TRACK_SEG_STRAIGHT, .exit = STRAIGHT_EXIT,
+      .distance = straight_04,     .line_v = SPEED_STRAIGHT_04,  .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .accel = ACCEL_STRAIGHT,     .jerk = JERK_STRAIGHT,    .decay = STRAIGHT_DECAY },
+    { .name = "右上角右拐九十度",   .type = TRACK_SEG_TURN,     .exit = TURN_EXIT,
+      .angle = -90.0f,             .timeout_ms = TURN_TIMEOUT(turn_right_90_B),
+      .line_v = SPEED_R_90_LINE,   .angular_v = SPEED_R_90_W,     .trans = RACE_TRANS, .settle_ms = TRACK_SETTLE_MS,
+      .decay = TURN_DECAY },
+    // rush rush !!! 进入冲刺段时记录结束时间
+    { .name = "冲刺",               .type = TRACK_SEG_RUSH,     .exit = TRACK_EXIT_TIME,
+      .time_ms = RUSH_TIME,        .line_v = SPEED_RUSH,         .trans = RACE_TRANS },
+};
 
+/*
+ * =============================================================================
+ * 3. 比赛任务
+ * =============================================================================
+ */
 
-//获得当前脉冲数
-int get_current_distance(){
-       encoder_count_M1 = Encoder_Get_Count_M1();
-       encoder_count_M2 = Encoder_Get_Count_M2();
-       encoder_count_M3 = Encoder_Get_Count_M3();
-       encoder_count_M4 = Encoder_Get_Count_M4();
-       
-    int total_pulse = encoder_count_M1 + encoder_count_M2 + encoder_count_M3 + encoder_count_M4;
+static void race_task(void *arg) {
+    bool finished = false;
 
-    return total_pulse / 4;
- };
+    ESP_LOGI(TAG, "FSM 任务已启动 core:%d", xPortGetCoreID());
 
- void clear_all_encoder(){
-	if (encoder_unit_m1 != NULL) {
-        pcnt_unit_clear_count(encoder_unit_m1);
+    float voltage = Battery_Get_Voltage();
+    ESP_LOGI(TAG, "=====================电池状态=====================");
+    ESP_LOGI(TAG, "Voltage:%.2fV, 额定电压:%.1fV", voltage, PWM_MOTOR_VBAT_NOMINAL);
+
+    // 开机时同时按住Key0和Key1：车轮悬空标定PWM线性化表，线性化表变化后接着重新标定前馈参数
+    if (Key0_Read_State() == KEY_STATE_PRESS && Key1_Read_State() == KEY_STATE_PRESS) {
+        ESP_LOGI(TAG, "标定PWM线性化表和电机前馈参数，请保持车轮悬空...");
+        if (Motor_Calibrate_Lut() != ESP_OK) {
+            ESP_LOGW(TAG, "PWM线性化表标定失败");
+        } else if (Motor_Calibrate_FF() != ESP_OK) {
+            ESP_LOGW(TAG, "前馈参数标定失败");
         }
-        if (encoder_unit_m2 != NULL) {
-        pcnt_unit_clear_count(encoder_unit_m2);
+        while (Key0_Read_State() == KEY_STATE_PRESS || Key1_Read_State() == KEY_STATE_PRESS) {
+            vTaskDelay(pdMS_TO_TICKS(10));
         }
-        if (encoder_unit_m3 != NULL) {
-        pcnt_unit_clear_count(encoder_unit_m3);
+    }
+
+    // 开机时按住Key1：车轮悬空标定电机前馈参数
+    else if (Key1_Read_State() == KEY_STATE_PRESS) {
+        ESP_LOGI(TAG, "标定电机前馈参数，请保持车轮悬空...");
+        if (Motor_Calibrate_FF() != ESP_OK) {
+            ESP_LOGW(TAG, "前馈参数标定失败");
         }
-        if (encoder_unit_m4 != NULL) {
-        pcnt_unit_clear_count(encoder_unit_m4);
+        while (Key1_Read_State() == KEY_STATE_PRESS) {
+            vTaskDelay(pdMS_TO_TICKS(10));
         }
     }
 
-//编码器脉冲数重置为零
- void reset_encoder_counts(){
-    clear_all_encoder();
-    encoder_count_M1 = 0;
-    encoder_count_M2 = 0;
-    encoder_count_M3 = 0;
-    encoder_count_M4 = 0;
-    return;
- };
-
-/*
- * =============================================================================
- * 3. 有限状态机 (FINITE STATE MACHINE)
- * =============================================================================
- */
+    // 开机时按住Key0：车轮悬空整定每个轮子的PID参数
+    else if (Key0_Read_State() == KEY_STATE_PRESS) {
+        ESP_LOGI(TAG, "整定电机PID参数，请保持车轮悬空...");
+        if (Motor_Auto_Tune_PID() != ESP_OK) {
+            ESP_LOGW(TAG, "PID参数整定失败");
+        }
+        while (Key0_Read_State() == KEY_STATE_PRESS) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
 
-// FSM 的所有状态
-typedef enum {
-    STATE_READY,            // 0. 准备阶段，等待发车
-    STATE_STRAIGHT_01,      // 1. 第一部分直线
-    STATE_TURN_RIGHT_150,   // 2. 右上150度弯
-    STATE_STRAIGHT_02,      // 3. 右下侧小直线
-    STATE_TURN_RIGHT_90_A,  // 4. 右下角右拐九十度
-    STATE_TURN_LEFT_60,     // 5. 右下左拐60度弯
-    STATE_STRAIGHT_03,      // 6. 底侧小直线
-    STATE_TURN_LEFT_63,     // 7. 左拐63.97度弯
-    STATE_TURN_RIGHT_153,   // 8. 右拐153.97度弯
-    STATE_STRAIGHT_04,      // 9. 左侧小直线
-    STATE_TURN_RIGHT_90_B,  // 10. 右上角右拐九十度
-    STATE_STOP              // 11. 停止 
-} state;
-
-// FSM 任务
-void race_task() {
-    state current_state = STATE_READY; 
-    
-    ESP_LOGI(TAG, "FSM 任务已启动。");
+    Track_Init(race_track, sizeof(race_track) / sizeof(race_track[0]));
+    Track_Set_Period(RACE_TASK_PERIOD);
 
-    float voltage = Battery_Get_Voltage();
-    ESP_LOGI(TAG, "=====================电池状态=====================");
-    ESP_LOGI(TAG, "Voltage:%.2fV", voltage);   
-    
-    double current_distance = 0.0;
-    //统计时间用的变量
-    int64_t start_time = 0;
-    int64_t end_time = 0;
+    // 准备阶段，等待发车
+    Motion_Ctrl(0,0,0);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    ESP_LOGI(TAG, "比赛开始...");
+    Motor_Reset_Ctrl_Cycles();
+    Track_Start();
 
     while (1) {
 
-        current_distance = get_current_distance();
-
-        ESP_LOGI(TAG,"distance now: %f, State: %d", current_distance, current_state);
+        // 延迟日志，不阻塞比赛循环
+        RACE_LOGI(TAG,"distance now: %d, State: %d", Track_Get_Distance(), Track_Get_Index());
 
-
-           if (Key1_Read_State() == 1 )
+        if (Key1_Read_State() == 1 )
         {
-           ESP_LOGI(TAG, "MANDATORY STOP");
-           Motion_Stop(true);
-           reset_encoder_counts();
+           RACE_LOGI(TAG, "MANDATORY STOP");
+           Track_Abort();
         }
 
-
-
-
-        // 状态机核心
-        switch (current_state) {
-            
-            case STATE_READY:
-                Motion_Ctrl(0,0,0);
-                vTaskDelay(pdMS_TO_TICKS(100));
-                // 切换进入赛道
-                ESP_LOGI(TAG, "比赛开始...");
-                ESP_LOGI(TAG, "已经进入第一个直线赛道");
-                
-                current_state = STATE_STRAIGHT_01;
-
-                start_time = esp_timer_get_time();
-
-                // 先重置，再运动
-                reset_encoder_counts();
-                Motion_Ctrl(SPEED_STRAIGHT_01, 0, 0);
-                break;
-
-            case STATE_STRAIGHT_01:
-                if(current_distance >= straight_01){
-                    ESP_LOGI(TAG, "完成直线 -> 进入第一个右转150度");
-                    current_state = STATE_TURN_RIGHT_150;
-                    
-                    
-                    Motion_Stop(false);             // 1. 先停车
-                    reset_encoder_counts();         // 2. 重置编码器
-                    vTaskDelay(pdMS_TO_TICKS(100)); // 3. 等待车身稳定 (消除惯性)
-                    
-                    Motion_Ctrl(SPEED_R_150_LINE, 0, SPEED_R_150_W); // 4. 执行下一段动作
-                    vTaskDelay(pdMS_TO_TICKS(turn_right_150)); //旋转多长时间 t = 转的角度/360° * T 这里都是角速度0.8所以T都是9s(设置角速度为0.8但实际很可能是0.7几)
-                }
-                break;
-
-            case STATE_TURN_RIGHT_150:
-                if (true) {
-                    ESP_LOGI(TAG, "右转150 -> 右下小直线");
-                    current_state = STATE_STRAIGHT_02;
-                    
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_STRAIGHT_02, 0, 0);
-                }
-                break;
-
-            case STATE_STRAIGHT_02:
-                if (current_distance >= straight_02) {
-                    ESP_LOGI(TAG, "右下小直线完成 -> 右转90度 ");
-                    current_state = STATE_TURN_RIGHT_90_A;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_R_90_LINE, 0, SPEED_R_90_W);
-                    vTaskDelay(pdMS_TO_TICKS(turn_right_90));
-                }
-                break;
-
-            case STATE_TURN_RIGHT_90_A:
-                if (true) {
-                    ESP_LOGI(TAG, "右转90完成 -> 左转60度");
-                    current_state = STATE_TURN_LEFT_60;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_L_60_LINE, 0, SPEED_L_60_W);
-                    vTaskDelay(pdMS_TO_TICKS(turn_left_60));
-                }
-                break;
-
-            case STATE_TURN_LEFT_60:
-                if (true) {
-                    ESP_LOGI(TAG, "左转60度 -> 底部小直线");
-                    current_state = STATE_STRAIGHT_03;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_STRAIGHT_03, 0, 0);
-                }
-                break;
-            
-            case STATE_STRAIGHT_03:
-                if (current_distance >= straight_03) {
-                    ESP_LOGI(TAG, " 底部小直线 -> 左转63.97");
-                    current_state = STATE_TURN_LEFT_63;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_L_63_LINE, 0, SPEED_L_63_W);
-                     vTaskDelay(pdMS_TO_TICKS(turn_left_63));
-                }
-                break;
-
-            case STATE_TURN_LEFT_63:
-                if (true) {
-                    ESP_LOGI(TAG, "左转63.97 -> 右转153.97");
-                    current_state = STATE_TURN_RIGHT_153;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_R_153_LINE, 0, SPEED_R_153_W);
-                    vTaskDelay(pdMS_TO_TICKS(turn_right_153));
-                }
-                break;
-
-            case STATE_TURN_RIGHT_153:
-                if (true) {
-                    ESP_LOGI(TAG, "右转153完成 -> 左侧小直线");
-                    current_state = STATE_STRAIGHT_04;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_STRAIGHT_04, 0, 0);
-                }
-                break;
-
-            case STATE_STRAIGHT_04:
-                if (current_distance >= straight_04) {
-                    ESP_LOGI(TAG, "左侧直线完成 -> 右转90");
-                    current_state = STATE_TURN_RIGHT_90_B;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    vTaskDelay(pdMS_TO_TICKS(100));
-
-                    Motion_Ctrl(SPEED_R_90_LINE, 0, SPEED_R_90_W);
-                     vTaskDelay(pdMS_TO_TICKS(turn_right_90_B));
-                }
-                break;
-
-            case STATE_TURN_RIGHT_90_B:
-                if (true) { 
-                    ESP_LOGI(TAG, "右转九十度完成 -> 结束状态");
-                    current_state = STATE_STOP;
-
-                    Motion_Stop(false);
-                    reset_encoder_counts();
-                    
-                    ESP_LOGI(TAG, "结束");
-                    end_time = esp_timer_get_time();
-                    
-
-                    // rush rush !!!
-                     Motion_Ctrl(0.8, 0, 0);
-                     vTaskDelay(pdMS_TO_TICKS(250));
-                }
-                break;
-
-            case STATE_STOP:
-                Motion_Stop(false); // 强制刹车
-
-                // esp_timer_get_time 返回的是微秒(us)，除以 1000000.0 变成秒(s)
-                if (start_time != 0 && end_time != 0) {
-                    double duration = (double)(end_time - start_time) / 1000000.0;
-                    ESP_LOGI(TAG, "=================================");
-                    ESP_LOGI(TAG, "  比赛结束!  ");
-                    ESP_LOGI(TAG, "  Total Time: %.4f s", duration);
-                    ESP_LOGI(TAG, "=================================");
-                    
-                    // 防止重复打印，清零变量或增加标志位
-                    start_time = 0; 
-                }
-                
-                // 这里加一个长延时，防止日志刷屏太快
-                vTaskDelay(pdMS_TO_TICKS(1000));
-
-                break;
+        if (!Track_Update())
+        {
+            // 正常结束时滑行停车；按键急停时Track_Abort已经刹车，保持刹车不动
+            if (Track_Get_State() != TRACK_STATE_ABORT) {
+                Motion_Stop(false);
+            }
+
+            // esp_timer_get_time 返回的是微秒(us)，除以 1000000.0 变成秒(s)
+            if (!finished && Track_Get_Lap_Time() != 0) {
+                double duration = (double)Track_Get_Lap_Time() / 1000000.0;
+                ESP_LOGI(TAG, "=================================");
+                ESP_LOGI(TAG, "  比赛结束!  ");
+                ESP_LOGI(TAG, "  Total Time: %.4f s", duration);
+                ESP_LOGI(TAG, "  Log dropped: %u, Overruns: %u", (unsigned int)RaceLog_Get_Dropped(),
+                         (unsigned int)Track_Get_Overruns());
+                // 控制周期耗时，单位：CPU周期
+                motor_ctrl_cycles_t cycles;
+                Motor_Get_Ctrl_Cycles(&cycles);
+                ESP_LOGI(TAG, "  Ctrl cycles avg/max: %u/%u, PWM: %u/%u", (unsigned int)cycles.ctrl_avg, (unsigned int)cycles.ctrl_max,
+                         (unsigned int)cycles.pwm_avg, (unsigned int)cycles.pwm_max);
+                ESP_LOGI(TAG, "=================================");
+                Track_Report();
+
+                // 防止重复打印
+                finished = true;
+            }
+
+            // 这里加一个长延时，防止日志刷屏太快
+            vTaskDelay(pdMS_TO_TICKS(1000));
         }
-        
-        // 10ms 轮询
-        vTaskDelay(pdMS_TO_TICKS(10));
+
+        // 定时器驱动的固定周期轮询，距离段结束时由编码器中断提前唤醒
+        Track_Wait();
     }
 }
 
@@ -368,10 +256,18 @@ void app_main(void)
 {
     // 初始化
     vTaskDelay(pdMS_TO_TICKS(1000));
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
+    RaceLog_Init();
     Key_Init();
     Battery_Init();
     Motor_Init();
+    Motion_Init();
 
     // --- 启动 FSM 任务 ---
-    race_task();
+    xTaskCreatePinnedToCore(race_task, "Race_Task", RACE_TASK_STACK, NULL, RACE_TASK_PRIO, NULL, RACE_TASK_CORE);
 }